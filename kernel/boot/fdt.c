@@ -0,0 +1,156 @@
+// Flattened device tree (FDT) parsing.
+//
+// 固件（-bios none 时是 QEMU 的复位代码）在 a1 中传入 FDT 的物理
+// 地址，entry.S 原样交给 start()。这里只读出包含 KERNBASE 的那段
+// 内存（/memory 节点的 reg 属性），据此设置 phystop；FDT 中的保留
+// 区域（/memreserve/）由 kinit() 跳过。
+//
+// FDT 中的数都是大端的。结构块是一串 4 字节对齐的 token：
+// BEGIN_NODE（后跟节点名）、END_NODE、PROP（后跟长度、属性名在
+// 字符串块中的偏移和值）、NOP 和 END。
+
+#include "../include/def.h"
+
+#define FDT_MAGIC       0xd00dfeed
+#define FDT_BEGIN_NODE  1
+#define FDT_END_NODE    2
+#define FDT_PROP        3
+#define FDT_NOP         4
+#define FDT_END         9
+#define FDT_ALIGN(x)    (((x) + 3) & ~3)
+
+struct fdt_header {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+uint64 phystop = PHYSTOP_DEFAULT;
+uint64 fdt_pa;                          // start() 保存的 FDT 地址
+struct fdt_resv fdt_resv[FDT_MAXRESV];  // FDT 自身和 /memreserve/ 区域
+int fdt_nresv;
+
+static uint32
+be32(const void *p)
+{
+  const uchar *b = p;
+  return ((uint32)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static uint64
+be64(const void *p)
+{
+  return ((uint64)be32(p) << 32) | be32((const uchar*)p + 4);
+}
+
+// 读出 cells 个 32 位单元组成的数
+static uint64
+fdt_cells(const uchar *p, int cells)
+{
+  return cells == 2 ? be64(p) : be32(p);
+}
+
+static int
+fdt_strneq(const char *s, const char *prefix)
+{
+  while(*prefix)
+    if(*s++ != *prefix++)
+      return 0;
+  return *s == 0 || *s == '@';
+}
+
+static void
+fdt_reserve(uint64 start, uint64 end)
+{
+  if(fdt_nresv == FDT_MAXRESV){
+    printf("fdtinit: too many reserved regions\n");
+    return;
+  }
+  fdt_resv[fdt_nresv].start = PGROUNDDOWN(start);
+  fdt_resv[fdt_nresv].end = PGROUNDUP(end);
+  fdt_nresv++;
+}
+
+// 解析 FDT，设置 phystop 并记下保留区域。没有 FDT 或格式不对时
+// 保持默认的 PHYSTOP_DEFAULT。在 kinit() 之前、开启分页之前调用。
+void
+fdtinit(void)
+{
+  const struct fdt_header *h = (const struct fdt_header*)fdt_pa;
+  const uchar *p, *end, *strings, *r;
+  const char *name;
+  uint32 tok, len;
+  int depth = 0, acells = 2, scells = 1, memnode = 0;
+  uint64 base, size, top = 0;
+
+  if(h == 0 || be32(&h->magic) != FDT_MAGIC){
+    printf("fdtinit: no device tree, assuming %d MiB\n",
+           (int)((phystop - KERNBASE) >> 20));
+    return;
+  }
+  fdt_reserve(fdt_pa, fdt_pa + be32(&h->totalsize));
+
+  // 内存保留表：(address, size) 对，以全 0 结束
+  for(r = (const uchar*)h + be32(&h->off_mem_rsvmap); be64(r + 8) != 0; r += 16)
+    fdt_reserve(be64(r), be64(r) + be64(r + 8));
+
+  p = (const uchar*)h + be32(&h->off_dt_struct);
+  end = p + be32(&h->size_dt_struct);
+  strings = (const uchar*)h + be32(&h->off_dt_strings);
+  while(p < end){
+    tok = be32(p);
+    p += 4;
+    if(tok == FDT_END)
+      break;
+    if(tok == FDT_BEGIN_NODE){
+      name = (const char*)p;
+      depth++;
+      memnode = depth == 2 && fdt_strneq(name, "memory");
+      p += FDT_ALIGN(strlen(name) + 1);
+    } else if(tok == FDT_END_NODE){
+      depth--;
+      memnode = 0;
+    } else if(tok == FDT_PROP){
+      len = be32(p);
+      name = (const char*)strings + be32(p + 4);
+      p += 8;
+      // 根节点的 #address-cells 和 #size-cells 决定 reg 的格式
+      if(depth == 1 && strcmp(name, "#address-cells") == 0)
+        acells = be32(p);
+      else if(depth == 1 && strcmp(name, "#size-cells") == 0)
+        scells = be32(p);
+      else if(memnode && strcmp(name, "reg") == 0){
+        for(r = p; r + 4*(acells + scells) <= p + len; r += 4*(acells + scells)){
+          base = fdt_cells(r, acells);
+          size = fdt_cells(r + 4*acells, scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            top = base + size;
+        }
+      }
+      p += FDT_ALIGN(len);
+    } else if(tok != FDT_NOP){
+      printf("fdtinit: bad token %d\n", tok);
+      return;
+    }
+  }
+
+  if(top == 0){
+    printf("fdtinit: no memory at KERNBASE, assuming %d MiB\n",
+           (int)((phystop - KERNBASE) >> 20));
+    return;
+  }
+  // 内核直接映射不能伸进 mmap 区域
+  if(top > PHYSTOP_MAX){
+    printf("fdtinit: using only %d MiB of RAM\n", (int)((PHYSTOP_MAX - KERNBASE) >> 20));
+    top = PHYSTOP_MAX;
+  }
+  phystop = top;
+  printf("fdtinit: %d MiB of RAM\n", (int)((phystop - KERNBASE) >> 20));
+}
@@ -7,11 +7,13 @@ void main();
 void timerinit();
 
 // entry.S needs one stack per CPU.
-__attribute__ ((aligned (16))) char stack0[4096];
+__attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on this hart's part of stack0,
+// with the hartid in a0 and the device tree address from the
+// firmware in a1. every hart comes through here.
 void
-start()
+start(uint64 hartid, uint64 dtb)
 {
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
@@ -39,6 +41,14 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // misa is only readable in machine mode; remember whether the
+  // vector extension is there for vecinit().
+  vec_present = (r_misa() & MISA_EXT('V')) != 0;
+
+  // main() on hart 0 reads memory size etc. from the device tree.
+  if(hartid == 0)
+    fdt_pa = dtb;
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -21,30 +21,56 @@
 #include "buf.h"
 #include "../utils/spinlock.h"
 #include "../utils/sleeplock.h"
+
+// bufs 由 slab 缓存按需分配，挂在以 head 为哨兵的双向 LRU 链表上，
+// head.next 最近使用，head.prev 最久未用。NBUF 只是空闲时保留的
+// 数量：缓存不够时继续分配，空闲后多出的部分再还给 slab。
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
-  // MVP: No LRU, just a simple array
+  struct kmem_cache *cache;
+  int nbuf;          // 链表上 buf 的个数
+  struct buf head;
 } bcache;
 
+// slab 构造函数：睡眠锁只需初始化一次
+static void
+buf_ctor(void *obj)
+{
+  struct buf *b = obj;
+
+  b->refcnt = 0;
+  initsleeplock(&b->lock, "buffer");
+}
+
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), buf_ctor);
+  if(bcache.cache == 0)
+    panic("binit");
 
-  // MVP: Simple initialization, no LRU list
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->refcnt = 0;
-    b->valid = 0;
-    b->dev = 0;
-    b->blockno = 0;
-    initsleeplock(&b->lock, "buffer");
-  }
+  bcache.head.prev = &bcache.head;
+  bcache.head.next = &bcache.head;
+  bcache.nbuf = 0;
+}
+
+static void
+lru_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+lru_push_front(struct buf *b)
+{
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
 }
 
-// MVP: Simplified bget - linear search, no LRU
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -56,7 +82,7 @@ bget(uint dev, uint blockno)
   acquire(&bcache.lock);
 
   // Is the block already cached?
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
       release(&bcache.lock);
@@ -65,20 +91,31 @@ bget(uint dev, uint blockno)
     }
   }
 
-  // Not cached - find an unused buffer
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached - below the soft limit grow the cache, otherwise
+  // recycle the least recently used unused buffer.
+  b = 0;
+  if(bcache.nbuf >= NBUF){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev)
+      if(b->refcnt == 0)
+        break;
+    if(b == &bcache.head)
+      b = 0;
   }
-  panic("bget: no buffers");
-  return 0;
+  if(b == 0){
+    if((b = kmem_cache_alloc(bcache.cache)) == 0)
+      panic("bget: no buffers");
+    bcache.nbuf++;
+  } else {
+    lru_remove(b);
+  }
+  lru_push_front(b);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,8 +142,8 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
-// MVP: Simplified brelse - no LRU movement
 // Release a locked buffer.
+// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -117,6 +154,16 @@ brelse(struct buf *b)
 
   acquire(&bcache.lock);
   b->refcnt--;
+  if(b->refcnt == 0){
+    lru_remove(b);
+    if(bcache.nbuf > NBUF){
+      // 超出保留数量，直接还给 slab
+      bcache.nbuf--;
+      kmem_cache_free(bcache.cache, b);
+    } else {
+      lru_push_front(b);
+    }
+  }
   release(&bcache.lock);
 }
 
@@ -13,15 +13,21 @@
 #include "../include/def.h"
 
 struct devsw devsw[NDEV];
+// 文件结构由 slab 缓存按需分配，不再有固定上限。
+// ftable.lock 保护所有 file 的 ref 字段。
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
+  int nfile;         // 当前打开的文件结构数
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file), 0);
+  if(ftable.cache == 0)
+    panic("fileinit");
 }
 
 // Allocate a file structure.
@@ -29,28 +35,25 @@ struct file*
 filealloc(void)
 {
   struct file *f;
-  int used = 0;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref > 0) used++;
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      // 初始化文件结构的所有字段
-      f->type = FD_NONE;
-      f->readable = 0;
-      f->writable = 0;
-      f->ip = 0;
-      f->off = 0;
-      f->major = 0;
-      // printf("[FILE] filealloc: used=%d/%d\n", used, NFILE);
-      return f;
-    }
+  if((f = kmem_cache_alloc(ftable.cache)) == 0){
+    // printf("[FILE] filealloc: FAILED! out of memory\n");
+    return 0;
   }
+  // 初始化文件结构的所有字段
+  f->ref = 1;
+  f->type = FD_NONE;
+  f->readable = 0;
+  f->writable = 0;
+  f->ip = 0;
+  f->off = 0;
+  f->major = 0;
+
+  acquire(&ftable.lock);
+  ftable.nfile++;
   release(&ftable.lock);
-  // printf("[FILE] filealloc: FAILED! All %d files in use\n", NFILE);
-  return 0;
+  // printf("[FILE] filealloc: used=%d\n", ftable.nfile);
+  return f;
 }
 
 // Increment ref count for file f.
@@ -81,13 +84,9 @@ fileclose(struct file *f)
   }
   ff = *f;
   f->ref = 0;
-  f->type = FD_NONE;
-  f->readable = 0;
-  f->writable = 0;
-  f->ip = 0;
-  f->off = 0;
-  f->major = 0;
+  ftable.nfile--;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
   
   // printf("[FILE] fileclose: freeing file (type=%d)\n", ff.type);
 
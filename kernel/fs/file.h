@@ -35,6 +35,9 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  struct inode *next;  // itable hash chain
+  struct inode *lprev; // LRU list of unreferenced inodes
+  struct inode *lnext;
 };
 
 // map major device number to device functions.
@@ -175,21 +175,77 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// In-memory inodes are allocated from a slab cache on demand and
+// found through a hash of (dev, inum). When its ref drops to zero a
+// valid inode stays in the hash and moves to an LRU list (lru.lnext
+// most recently used), so reopening a file does not have to read the
+// dinode again; beyond NINODE unreferenced inodes the least recently
+// used one is returned to the cache.
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
+  int nunused;       // LRU 链表上 inode 的个数
+  struct inode lru;
 } itable;
 
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
+// slab 构造函数：睡眠锁只需初始化一次
+static void
+inode_ctor(void *obj)
+{
+  struct inode *ip = obj;
+
+  initsleeplock(&ip->lock, "inode");
+  ip->ref = 0;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode), inode_ctor);
+  if(itable.cache == 0)
+    panic("iinit");
+  itable.lru.lprev = &itable.lru;
+  itable.lru.lnext = &itable.lru;
+  itable.nunused = 0;
+}
+
+// 下面几个函数的调用者持有 itable.lock
+static void
+ilru_remove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  itable.nunused--;
+}
+
+static void
+ilru_push_front(struct inode *ip)
+{
+  ip->lnext = itable.lru.lnext;
+  ip->lprev = &itable.lru;
+  itable.lru.lnext->lprev = ip;
+  itable.lru.lnext = ip;
+  itable.nunused++;
+}
+
+// 从哈希链摘下 ip 并还给 slab 缓存
+static void
+ifree(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  kmem_cache_free(itable.cache, ip);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -249,31 +305,31 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[h]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new in-memory inode.
+  if((ip = kmem_cache_alloc(itable.cache)) == 0)
+    panic("iget: no memory for inode");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -330,8 +386,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the in-memory inode moves to
+// the LRU list of unreferenced inodes.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -360,7 +416,21 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid == 0){
+      // 没读入过或刚在磁盘上释放，留着没有用处
+      ifree(ip);
+    } else {
+      // 最后一个引用：留在 LRU 链表上，超出保留数量时
+      // 还掉最久未用的那个
+      ilru_push_front(ip);
+      if(itable.nunused > NINODE){
+        ip = itable.lru.lprev;
+        ilru_remove(ip);
+        ifree(ip);
+      }
+    }
+  }
   release(&itable.lock);
 }
 
@@ -420,6 +490,8 @@ itrunc(struct inode *ip)
 {
   int i;
 
+  pcache_invalidate(ip);
+
   // MVP: Only free direct blocks
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -505,6 +577,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    // 页缓存中的页可能被共享映射着，原地更新
+    pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
     brelse(bp);
   }
 
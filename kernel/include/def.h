@@ -18,6 +18,8 @@ struct inode;
 struct superblock;
 struct file;
 struct stat;
+struct kmem_cache;
+struct vma;
 
 // 自定义assert宏
 #define assert(condition) \
@@ -31,6 +33,7 @@ struct stat;
 
 //printf.c
 void printint(long long value, int base, int sgn);
+void printfinit(void);
 void printf(const char *fmt, ...);
 void panic(char *s);
 void clear_screen(void);
@@ -50,10 +53,91 @@ void cons_putc(int c);
 void cons_puts(const char *s);
 int cons_getc(void);
 
+// fdt.c
+struct fdt_resv {
+  uint64 start;
+  uint64 end;
+};
+extern uint64 fdt_pa;
+extern struct fdt_resv fdt_resv[FDT_MAXRESV];
+extern int fdt_nresv;
+void            fdtinit(void);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_nozero(void);
+void*           kalloc_pages(int order);
+void            kfree_pages(void *pa, int order);
+void            kmem_stats(void);
+int             kfree_blocks(int order);
+void            kzero_kick(void);
+void            kzerod(void);
+void            kref_inc(void *pa);
+int             kref_get(void *pa);
+int             kfreepages(void);
+
+// swap.c
+void            swapinit(void);
+void            swap_free(uint64);
+void            swap_dup(uint64);
+int             swap_in(pagetable_t, uint64, pte_t *);
+int             swap_reclaim(int);
+void*           kalloc_user(int);
+void            swap_kick(void);
+void            kswapd(void);
+
+// zram.c
+void            zraminit(void);
+long            zram_store(void *);
+void            zram_load(uint64, void *);
+void            zram_free(uint64);
+void            zram_dup(uint64);
+
+// ksm.c
+void            ksminit(void);
+void            ksmd(void);
+
+// memstat.c
+// 进程的内存统计（与用户态保持一致），单位是页。rss、wss、dirty 和
+// swapped 是 kwsd 上一次扫描的结果，缺页次数实时累计。
+struct memstat {
+  uint64 rss;       // 驻留的用户页
+  uint64 wss;       // 上一个采样周期内访问过的页（工作集）
+  uint64 dirty;     // 上一个采样周期内写过的页
+  uint64 swapped;   // 换出（到压缩内存或交换盘）的页
+  uint64 minflt;    // 不需要换入的缺页
+  uint64 majflt;    // 需要换入的缺页
+};
+void            kwsd(void);
+int             memstat(int, struct memstat *);
+
+// slab.c
+struct kmem_cache* kmem_cache_create(char *name, uint size, void (*ctor)(void *));
+void*           kmem_cache_alloc(struct kmem_cache *c);
+void            kmem_cache_free(struct kmem_cache *c, void *obj);
+void            kmem_cache_stats(void);
+
+// vma.c
+void            vmainit(void);
+int             vma_add(struct vma **, uint64, uint64, int, int, struct inode *, uint64, uint64);
+struct vma*     vma_find(struct vma *, uint64);
+void            vma_free(struct vma **);
+int             vma_dup(struct vma **, struct vma *);
+int             vma_fault(struct proc *, struct vma *, uint64);
+void            vma_unmap(pagetable_t, struct vma *, uint64, uint64);
+void            vma_release(pagetable_t, struct vma **);
+uint64          vma_mmap(struct proc *, uint64, int, int, struct inode *, uint64);
+int             vma_munmap(struct proc *, uint64, uint64);
+struct vma*     vma_growstack(struct proc *, uint64);
+
+// pagecache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode *, uint64);
+void            pcache_write(struct inode *, uint64, char *, uint);
+void            pcache_invalidate(struct inode *);
+int             pcache_reclaim(int);
 
 // string.c
 void* memset(void *dst, int c, uint n);
@@ -63,30 +147,68 @@ int   strlen(const char *s);
 char* safestrcpy(char *s, const char *t, int n);
 int   sprintf(char *dst, const char *fmt, ...);
 void* memmove(void *dst, const void *src, uint n);
+void* memcpy(void *dst, const void *src, uint n);
+int   memcmp(const void *v1, const void *v2, uint n);
+uint64 memsum(const void *p, uint n);
+
+// vec.c
+#define VEC_MINBYTES 256   // 更小的块用标量代码更快
+extern int vec_present;
+extern int vec_enabled;
+void    vecinit(void);
+void    vec_memset(void *dst, int c, uint n);
+void    vec_memcpy(void *dst, const void *src, uint n);
+uint64  vec_memsum(const uint32 *p, uint nwords);
 int   strncmp(const char *p, const char *q, uint n);
 char* strncpy(char *s, const char *t, int n);
 
 
 // vm.c
+// 按 (pid, va) 的顺序循环遍历所有用户进程私有页的游标（见 uvm_scan_next）
+struct uvm_scan {
+  int pid;
+  uint64 va;
+  uint64 scanned;   // 累计访问过的页数
+};
+
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapregion(pagetable_t, uint64, uint64, uint64, int, int);
 pagetable_t     create_pagetable(void);
 void            free_pagetable(pagetable_t);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             ismapped(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
 uint64         uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyin_str(pagetable_t, char *, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
+int             cowfault(pagetable_t, uint64);
+int             vmfault(struct proc *, uint64, int);
+// vmfault() 的访问类型
+#define FAULT_READ  0
+#define FAULT_WRITE 1
+#define FAULT_EXEC  2
+uint64          uvm_satp(struct proc *);
+void            uvm_flush(pagetable_t);
+void            uvm_flushproc(struct proc *);
+int             uvm_range(struct proc *, uint64, uint64 *, uint64 *, int);
+struct proc*    uvm_scan_next(struct uvm_scan *, uint64 *, pte_t **);
+void            uvmkshare(pagetable_t);
+void            uvmkunshare(pagetable_t);
+int             uvm_kshared(uint64, uint64);
+uint64          uaccess_fixup(uint64);
 // trap.c
 void trapinithart(void);
 void test_timer_interrupt(void);
@@ -97,6 +219,20 @@ void usertrap(void);
 void usertrapret(void);
 void kerneltrap(struct k_trapframe *tf);
 void sbi_set_timer(uint64 time);
+// timer.c
+// 内核定时器：到 when 时在时钟中断中调用 fn(arg)
+struct timer {
+  uint64 when;            // 到期时间（r_time() 的单位）
+  void (*fn)(void*);
+  void *arg;
+  int idx;                // 在堆中的下标，0 表示不在堆中
+};
+void            ktimerinit(void);
+int             timer_add(struct timer*);
+void            timer_del(struct timer*);
+void            timer_expire(void);
+uint64          timer_next(uint64);
+void            sleep_ticks(uint64 ticks);
 // plic.c
 void plicinit(void);
 void plicinithart(void);
@@ -145,6 +281,41 @@ extern volatile int global_interrupt_count;
 #define SYS_FSTAT   12
 #define SYS_UNLINK  13
 #define SYS_MKDIR   14
+#define SYS_KSTAT   15
+#define SYS_MMAP    16
+#define SYS_MUNMAP  17
+#define SYS_MEMSTAT 18
+
+// mmap 的 prot 与 flags（取值与 Linux 相同，与用户态保持一致）
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED    ((uint64)-1)
+
+// 内核统计计数器编号，sys_kstat(id) 返回对应的值（与用户态保持一致）
+#define KSTAT_SYSCALL       0   // 系统调用次数
+#define KSTAT_TLB_FLUSH     1   // 整个 TLB 的刷新次数
+#define KSTAT_ASID_FLUSH    2   // 按 ASID 作废某个地址空间的次数
+#define KSTAT_ASID_ROLLOVER 3   // ASID 代数回绕次数
+#define KSTAT_PCACHE_HIT    4   // 只读文件页在页缓存中命中
+#define KSTAT_PCACHE_MISS   5   // 只读文件页需要从文件读入
+#define KSTAT_SWAP_OUT      6   // 换出到交换盘的页数
+#define KSTAT_SWAP_IN       7   // 从交换盘换入的页数
+#define KSTAT_ZRAM_STORE    8   // 压缩存入内存的页数
+#define KSTAT_ZRAM_HIT      9   // 换入时在压缩内存中找到
+#define KSTAT_ZRAM_MISS     10  // 换入时要从交换盘读
+#define KSTAT_ZRAM_ORIG     11  // 压缩内存中页面的原始字节数（当前值）
+#define KSTAT_ZRAM_COMPR    12  // 压缩数据占用的字节数（当前值）
+#define KSTAT_KSM_SCANNED   13  // ksmd 扫描过的页数
+#define KSTAT_KSM_PASSES    14  // ksmd 扫完所有进程的圈数
+#define KSTAT_KSM_SHARED    15  // 合并页的个数（上一圈结束时）
+#define KSTAT_KSM_SAVED     16  // 合并省下的页数（上一圈结束时）
+#define KSTAT_SCHED_STEAL   17  // 空闲CPU从其他运行队列偷来的进程数
+#define KSTAT_SCHED_MIGRATE 18  // 进程换到另一个CPU上运行的次数
+#define KSTAT_NR            19
 // 陷阱帧结构体定义
 struct k_trapframe {
      /*   0 */ uint64 ra;
@@ -202,6 +373,16 @@ uint64 sys_sbrk(void);
 uint64 sys_fstat(void);
 uint64 sys_unlink(void);
 uint64 sys_mkdir(void);
+uint64 sys_kstat(void);
+uint64 sys_mmap(void);
+uint64 sys_munmap(void);
+uint64 sys_memstat(void);
+extern uint64 kstat[KSTAT_NR];
+// 计数器会在多个CPU上同时增加，必须用原子加；表示当前值的
+// 计数器（如 KSTAT_ZRAM_COMPR）用原子写入
+#define kstat_add(id, n) __sync_fetch_and_add(&kstat[id], (n))
+#define kstat_inc(id)    kstat_add(id, 1)
+#define kstat_set(id, v) __atomic_store_n(&kstat[id], (v), __ATOMIC_RELAXED)
 void syscall(void);
 
 // proc.c
@@ -211,7 +392,9 @@ struct proc* allocproc(void);
 int             cpuid(void);
 int             allocpid(void);
 void            userinit(void);
+struct proc*    kthread_create(char *name, void (*fn)(void), int idle);
 struct proc*    find_proc_by_pid(int);
+struct proc*    proc_next_user(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 struct cpu*     mycpu(void);
@@ -223,6 +406,7 @@ void            sched(void);
 void            sleep(void *chan);
 void            sleep_lock(void *chan, struct spinlock *lk);
 void            wakeup(void *chan);
+void            wakeup_proc(struct proc *p, void *chan);
 void            wakeup_lock(void *chan);
 void            exit(int status);
 int             wait(uint64 addr);
@@ -232,8 +416,6 @@ int             growproc(int n);
 int             kill(int pid);
 int             killed(struct proc *p);
 void            setkilled(struct proc *p);
-void            wakeup_timer(void);
-void            sleep_ticks(uint64 ticks);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 // proc_test.c
@@ -281,6 +463,9 @@ void pop_off(void);
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
+uint64          virtio_swap_init(void);
+void            virtio_swap_rw(void *, uint64, int);
+void            virtio_swap_intr(void);
 
 // bio.c
 void binit(void);
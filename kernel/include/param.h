@@ -1,15 +1,38 @@
 #define NPROC        64  // maximum number of processes
-#define NCPU          1  // maximum number of CPUs
+#define NCPU          8  // maximum number of CPUs
+#define PIDHASH      64  // buckets in the pid hash table
+#define NWAITQ       64  // buckets in the sleep/wakeup channel hash table
+#define NTIMER       (NPROC*2)  // max pending kernel timers
+#define TIMESLICE    1000000  // time ticks per scheduling quantum (about 100 ms)
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // bufs kept cached when idle (soft limit)
+#define NINODE       50  // unreferenced inodes kept cached (soft limit)
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define USERSTACK    1     // user stack pages
+#define USERSTACK    1     // user stack pages mapped by exec
+#define USTACKMAX    (8*1024*1024)  // user stack may grow to this many bytes
+#define KCACHE_BATCH 16    // pages moved between per-CPU cache and global list
+#define KCACHE_HIGH  (KCACHE_BATCH*4)  // per-CPU cache drains above this
+#define MAXORDER     10    // largest buddy block is 2^MAXORDER pages (4 MiB)
+#define ZPOOL_HIGH   256   // kzerod keeps up to this many pre-zeroed pages
+#define ZPOOL_LOW    (ZPOOL_HIGH/2)  // scheduler wakes kzerod below this
 
+#define SWAP_LOW     256   // allocator wakes kswapd when free pages drop below this
+#define SWAP_HIGH    512   // kswapd reclaims until this many pages are free
+#define SWAP_BATCH   32    // pages reclaimed per swap_reclaim() call
+#define SWAP_SCAN    4096  // max PTEs the clock hand visits per swap_reclaim()
+#define SWAPMAX      65536 // max swap slots (256 MiB of swap)
+#define ZRAM_PAGES   16384 // max pages held compressed in RAM
+#define ZRAM_LIMIT   8192  // max pages of memory used for compressed data
+#define ZRAM_CLASS   256   // compressed data is stored in multiples of this
+#define ZRAM_MAXLEN  3072  // pages that compress worse than this go to disk
+#define KSM_BATCH    256   // pages ksmd scans per wakeup
+#define KSM_INTERVAL 2000000  // ksmd sleeps this many time ticks (200 ms) between batches
+#define KSM_HASH     256   // buckets in the ksm checksum tables
+#define WS_INTERVAL  10000000 // kwsd samples accessed/dirty bits every this many time ticks (1 s)
+#define FDT_MAXRESV  8     // max reserved memory regions taken from the device tree
@@ -30,6 +30,17 @@ w_mstatus(uint64 x)
   asm volatile("csrw mstatus, %0" : : "r" (x));
 }
 
+// Machine ISA Register: one bit per single-letter extension.
+#define MISA_EXT(c) (1L << ((c) - 'A'))
+
+static inline uint64
+r_misa()
+{
+  uint64 x;
+  asm volatile("csrr %0, misa" : "=r" (x) );
+  return x;
+}
+
 // machine exception program counter, holds the
 // instruction address to which a return from
 // exception will go.
@@ -41,6 +52,9 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User memory
+#define SSTATUS_VS (3L << 9)   // Vector state: 0=Off, 1=Initial, 2=Clean, 3=Dirty
+#define SSTATUS_VS_INITIAL (1L << 9)
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -224,6 +238,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp bits 59:44 hold the address-space identifier (ASID).
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | (((uint64)(asid) & SATP_ASID_MASK) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -366,6 +386,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the non-global TLB entries tagged with asid.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -382,6 +409,12 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // global mapping, present in every address space
+#define PTE_A (1L << 6) // accessed (set by hardware)
+#define PTE_D (1L << 7) // dirty (set by hardware)
+#define PTE_COW (1L << 8) // copy-on-write page (RSW bit, ignored by hardware)
+#define PTE_SWAP (1L << 9) // page is on the swap disk (RSW bit, only with PTE_V clear)
+#define PTE_REF (1L << 9)  // PTE_A cleared by the working-set scanner (only with PTE_V set)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -390,11 +423,23 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a swapped-out page keeps its swap slot where the PPN would be.
+#define SWAP2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SWAP(pte) ((pte) >> 10)
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// size of the region mapped by one leaf PTE at the given level:
+// 4 KiB at level 0, 2 MiB at level 1, 1 GiB at level 2.
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
+
+// a valid PTE with any of R/W/X set is a leaf; otherwise it
+// points to the next-level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
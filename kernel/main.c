@@ -10,20 +10,45 @@ void test_printf_edge_cases();
 void console_demo(void);
 void progress_bar_demo(void);
 void test_physical_memory(void);
+void test_buddy_alloc(void);
+void test_slab_alloc(void);
 void test_pagetable(void);
+void test_string_ops(void);
+void test_string_bench(void);
 
 
 void system_shutdown(void);
 void delay_seconds(int seconds);
 
+// hart 0 完成全局初始化后置 1，其他 hart 才开始初始化自己
+static volatile int started = 0;
+
 void main(void) {
+  if(cpuid() != 0){
+    while(started == 0)
+      ;
+    __sync_synchronize();
+    kvminithart();   // turn on paging
+    trapinithart();  // install kernel trap vector
+    plicinithart();  // ask PLIC for device interrupts
+    printf("hart %d starting\n", cpuid());
+    scheduler();
+  }
+
+  printfinit();
   printf("My RISC-V OS Starting...\r\n");
 
   //初始化
+  vecinit();       // RVV string ops if the hart has V
+  fdtinit();       // RAM size from the device tree
   kinit();
   kvminit();
   kvminithart();
+  asidinit();      // probe ASID width (same on every hart)
   procinit();
+  ktimerinit();
+  vmainit();       // per-process VMA cache
+  pcacheinit();    // shared read-only file pages
   trapinithart();
   plicinit();      // PLIC interrupt controller
   plicinithart();  // enable interrupts for this hart
@@ -32,13 +57,24 @@ void main(void) {
   iinit();         // inode table
   fileinit();      // file table
   virtio_disk_init(); // emulated hard disk
+  zraminit();      // compressed in-RAM swap tier
+  swapinit();      // optional swap disk on virtio-mmio-bus.1
+  ksminit();       // same-page merging
   userinit();      // first user process
+  kthread_create("kzerod", kzerod, 1); // idle-time page zeroing
+  kthread_create("kswapd", kswapd, 0); // background page reclaim
+  kthread_create("ksmd", ksmd, 0);     // merge identical user pages
+  kthread_create("kwsd", kwsd, 0);     // sample working sets
   __sync_synchronize();
   //测试函数
   // test_printf_basic();
   // test_printf_edge_cases();
   // test_physical_memory();
+  test_buddy_alloc();
+  test_slab_alloc();
+  test_string_ops();
   // test_pagetable();
+  // test_string_bench();
   // console_demo();
   // progress_bar_demo();
 
@@ -56,6 +92,8 @@ void main(void) {
   // printf("Process table test passed!\n");
 
   printf("System initialization complete!\r\n");
+  __sync_synchronize();
+  started = 1;
   
   // 创建第一个用户进程
   
@@ -215,6 +253,82 @@ void test_physical_memory(void) {
 
 }
 
+void test_buddy_alloc(void) {
+  int before[MAXORDER+1];
+  char *top;
+
+  // 记下各阶空闲块数，全部释放后应当合并回原样
+  for(int o = 0; o <= MAXORDER; o++)
+    before[o] = kfree_blocks(o);
+
+  // 2MiB（order 9）块必须自然对齐
+  char *big = kalloc_pages(9);
+  assert(big != 0);
+  assert(((uint64)big & ((PGSIZE << 9) - 1)) == 0);
+  big[0] = 1;
+  big[(PGSIZE << 9) - 1] = 2;
+
+  // 连续的小块分配互不重叠且各自对齐
+  char *a = kalloc_pages(1);
+  char *b = kalloc_pages(2);
+  assert(a != 0 && b != 0);
+  assert(((uint64)a & ((PGSIZE << 1) - 1)) == 0);
+  assert(((uint64)b & ((PGSIZE << 2) - 1)) == 0);
+  assert(a + (PGSIZE << 1) <= b || b + (PGSIZE << 2) <= a);
+  kfree_pages(a, 1);
+  kfree_pages(b, 2);
+
+  kfree_pages(big, 9);
+
+  // 伙伴重新合并：各阶空闲块数恢复，仍能分配最大的块
+  for(int o = 0; o <= MAXORDER; o++)
+    assert(kfree_blocks(o) == before[o]);
+  top = kalloc_pages(MAXORDER);
+  assert(top != 0);
+  kfree_pages(top, MAXORDER);
+  for(int o = 0; o <= MAXORDER; o++)
+    assert(kfree_blocks(o) == before[o]);
+  kmem_stats();
+
+  printf("Buddy allocator test-------------------------- passed!\n");
+}
+
+static int slab_test_ctor_calls;
+
+static void
+slab_test_ctor(void *obj)
+{
+  *(int*)obj = 0x5a5a;
+  slab_test_ctor_calls++;
+}
+
+void test_slab_alloc(void) {
+  struct kmem_cache *c = kmem_cache_create("slabtest", 200, slab_test_ctor);
+  void *objs[64];
+  assert(c != 0);
+
+  // 对象两两不同，且都经过构造函数初始化
+  for(int i = 0; i < 64; i++){
+    objs[i] = kmem_cache_alloc(c);
+    assert(objs[i] != 0);
+    assert(*(int*)objs[i] == 0x5a5a);
+    for(int j = 0; j < i; j++)
+      assert(objs[i] != objs[j]);
+  }
+  assert(slab_test_ctor_calls >= 64);
+
+  // 释放后再分配不会重复调用构造函数
+  for(int i = 0; i < 64; i++)
+    kmem_cache_free(c, objs[i]);
+  int calls = slab_test_ctor_calls;
+  objs[0] = kmem_cache_alloc(c);
+  assert(slab_test_ctor_calls == calls);
+  kmem_cache_free(c, objs[0]);
+
+  kmem_cache_stats();
+  printf("Slab allocator test--------------------------- passed!\n");
+}
+
 void test_pagetable(void) {
 // 页对齐检查
 pagetable_t pt = create_pagetable();
@@ -236,6 +350,174 @@ assert(*pte & PTE_R);
 assert(*pte & PTE_W);
 assert(!(*pte & PTE_X));
 
+// 内核直接映射的高端RAM应该是 2MiB 大页（level 1 叶子）
+extern pagetable_t kernel_pagetable;
+uint64 kva = PHYSTOP - LEVELSIZE(1);
+pte = (uint64 *)walklevel(kernel_pagetable, kva, 0, 0);
+assert(pte != 0 && (*pte & PTE_V) && PTE_LEAF(*pte));
+assert(pte == (uint64 *)walklevel(kernel_pagetable, kva, 1, 0));
+assert(PTE2PA(*pte) == kva);
+
 printf("Pagetable test-------------------------------- passed!\n");
 
-}
\ No newline at end of file
+}
+// 字符串函数正确性测试：源和目的取遍字内偏移的所有组合，长度包括
+// 不是 8 的倍数的尾部和走向量实现的大块，memmove 的源和目的在两个
+// 方向上重叠。缓冲区先填入 strtest_pat()，操作后逐字节和预期比较，
+// 包括目的区域前后没有被写到的字节。
+static uint strtest_lens[] = { 0, 1, 7, 8, 9, 63, 64, 65, 203, 515 };
+static int strtest_shifts[] = { -17, -8, -3, -1, 1, 3, 8, 17 };
+
+static uchar
+strtest_pat(uint i)
+{
+  return (i * 7 + 3) & 0xff;
+}
+
+static void
+strtest_fill(uchar *buf, uint lim)
+{
+  for(uint i = 0; i < lim; i++)
+    buf[i] = strtest_pat(i);
+}
+
+// buf 的前 lim 字节中，[d, d+n) 应为原来 [s, s+n) 的内容，其余不变
+static void
+strtest_check_move(uchar *buf, uint d, uint s, uint n, uint lim)
+{
+  for(uint i = 0; i < lim; i++){
+    if(i >= d && i < d + n)
+      assert(buf[i] == strtest_pat(s + i - d));
+    else
+      assert(buf[i] == strtest_pat(i));
+  }
+}
+
+void test_string_ops(void) {
+  uchar *a = kalloc_pages(1);
+  uchar *b = kalloc_pages(1);
+  uint so, d0, n, i, k, j;
+  int r;
+
+  assert(a != 0 && b != 0);
+  for(k = 0; k < sizeof(strtest_lens)/sizeof(strtest_lens[0]); k++){
+    n = strtest_lens[k];
+
+    // memset：每种目的对齐
+    for(d0 = 0; d0 < 8; d0++){
+      strtest_fill(a, 1024);
+      memset(a + 8 + d0, 0xa5, n);
+      for(i = 0; i < 1024; i++)
+        assert(a[i] == (i >= 8 + d0 && i < 8 + d0 + n ? 0xa5 : strtest_pat(i)));
+    }
+
+    // 不重叠的 memcpy/memmove：源和目的对齐的每种组合
+    for(so = 0; so < 8; so++){
+      for(d0 = 0; d0 < 8; d0++){
+        strtest_fill(a, 1600);
+        memcpy(a + 1024 + d0, a + so, n);
+        strtest_check_move(a, 1024 + d0, so, n, 1600);
+
+        strtest_fill(a, 1600);
+        memmove(a + 1024 + d0, a + so, n);
+        strtest_check_move(a, 1024 + d0, so, n, 1600);
+      }
+    }
+
+    // 重叠的 memmove：目的在源之前（向前复制）和之后（向后复制）
+    for(so = 0; so < 8; so++){
+      for(j = 0; j < sizeof(strtest_shifts)/sizeof(strtest_shifts[0]); j++){
+        uint s = 64 + so, d = s + strtest_shifts[j];
+        strtest_fill(a, 1024);
+        memmove(a + d, a + s, n);
+        strtest_check_move(a, d, s, n, 1024);
+      }
+    }
+
+    // memcmp：相等、区域之外不同、区域中间和最后一个字节不同
+    for(so = 0; so < 8; so++){
+      for(d0 = 0; d0 < 8; d0++){
+        strtest_fill(a + so, n);
+        strtest_fill(b + d0, n);
+        a[so + n] = 1;
+        b[d0 + n] = 2;
+        assert(memcmp(a + so, b + d0, n) == 0);
+        if(n == 0)
+          continue;
+        for(i = n / 2; ; i = n - 1){
+          b[d0 + i] ^= 0x80;
+          r = memcmp(a + so, b + d0, n);
+          assert(a[so + i] < b[d0 + i] ? r < 0 : r > 0);
+          b[d0 + i] ^= 0x80;
+          if(i == n - 1)
+            break;
+        }
+      }
+    }
+  }
+
+  kfree_pages(a, 1);
+  kfree_pages(b, 1);
+  printf("String ops test------------------------------- passed!\n");
+}
+
+// 字符串函数微基准：每种操作重复 STRBENCH_ITERS 次，按 time CSR 的
+// 计数（QEMU virt 上为 10MHz）报告每个计数周期处理的字节数，
+// 用于追踪 memset/memmove/memcmp/memsum 的性能回退。在有 V 扩展的
+// 机器上较大的块走的是 vec.c 中的向量实现。
+#define STRBENCH_ITERS 256
+
+static void
+strbench_report(char *name, uint n, uint64 ticks)
+{
+  uint64 bytes = (uint64)n * STRBENCH_ITERS;
+
+  if(ticks == 0)
+    ticks = 1;
+  printf("[STRBENCH] %s %d bytes: %d ticks, %d bytes/tick\n",
+         name, n, (int)ticks, (int)(bytes / ticks));
+}
+
+void test_string_bench(void) {
+  char *a = kalloc_pages(1);
+  char *b = kalloc_pages(1);
+  uint sizes[] = { 64, 1024, 2*PGSIZE - 8 };
+  uint64 t0;
+  int i, k;
+
+  assert(a != 0 && b != 0);
+  for(k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++){
+    uint n = sizes[k];
+
+    t0 = r_time();
+    for(i = 0; i < STRBENCH_ITERS; i++)
+      memset(a, i, n);
+    strbench_report("memset", n, r_time() - t0);
+
+    t0 = r_time();
+    for(i = 0; i < STRBENCH_ITERS; i++)
+      memmove(b, a, n);
+    strbench_report("memmove", n, r_time() - t0);
+
+    // 源和目的相对错开一个字节，只能逐字节复制
+    t0 = r_time();
+    for(i = 0; i < STRBENCH_ITERS; i++)
+      memmove(b + 1, a, n - 1);
+    strbench_report("memmove-unaligned", n - 1, r_time() - t0);
+
+    memmove(b, a, n);
+    t0 = r_time();
+    for(i = 0; i < STRBENCH_ITERS; i++)
+      assert(memcmp(a, b, n) == 0);
+    strbench_report("memcmp", n, r_time() - t0);
+
+    t0 = r_time();
+    for(i = 0; i < STRBENCH_ITERS; i++)
+      memsum(a, n);
+    strbench_report("memsum", n, r_time() - t0);
+  }
+
+  kfree_pages(a, 1);
+  kfree_pages(b, 1);
+  printf("String bench---------------------------------- done!\n");
+}
@@ -1,8 +1,27 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// 底层是一个二进制伙伴系统（buddy allocator），按 2^order 页
+// 管理物理内存，释放时与伙伴块合并，kalloc_pages(order) 可以
+// 分配自然对齐的连续物理内存（如 order 9 即 2MiB）。
+//
+// 每个CPU持有一个小的空闲页缓存（magazine），kalloc/kfree
+// 优先在本CPU缓存上操作，只有缓存空了或满了才批量地与
+// 伙伴系统交换 KCACHE_BATCH 个单页，从而减少对全局锁的争用。
+//
+// 空闲页不再在启动时或释放时清零。内核线程 kzerod 在CPU空闲时
+// 预先清零最多 ZPOOL_HIGH 个页放入零页池。和空闲页一样，每个CPU
+// 缓存里也有一小批零页，一次从池中取 KCACHE_BATCH 个；kalloc()
+// 优先用本CPU的零页，都没有时才在分配路径上 memset。会整页覆盖
+// 内容的调用者可以用 kalloc_nozero() 跳过清零。
+//
+// 每个页有一个引用计数，kalloc 返回时为 1。写时复制（COW）的
+// fork 让父子进程共享页并用 kref_inc() 增加计数，kfree() 只在
+// 计数降为 0 时才真正释放。
 
 #include "../include/def.h"
+#include "../utils/spinlock.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -11,27 +30,218 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;   // 仅伙伴系统空闲链表使用，便于合并时 O(1) 摘除
 };
 
-struct {
+// 每个物理页的元数据，按 (pa - KERNBASE) / PGSIZE 索引
+struct page {
+  uchar free;       // 是否为伙伴系统中某个空闲块的首页
+  uchar order;      // 该块的阶（仅对块首页有效）
+  uint ref;         // 已分配页的引用计数（COW 共享）
+};
+
+#define PA2PG(pa) (&pages[((uint64)(pa) - KERNBASE) >> PGSHIFT])
+
+// 页元数据数组的大小取决于启动时探测到的内存大小，放在内核映像
+// 之后，kinit() 中分配
+static struct page *pages;
+static char *freestart;   // 第一个可分配的页
+
+// 每CPU页缓存
+struct kcache {
   struct run *freelist;
+  int count;        // 缓存中的页数
+  uint64 hits;      // 直接从本地缓存分配成功的次数
+  uint64 misses;    // 本地缓存为空、需要从伙伴系统补充的次数
+  struct run *zfree;  // 从零页池取来的零页
+  int zcount;
+  uint64 zhits;     // kalloc() 拿到零页的次数
+  uint64 zmisses;   // 没有零页、在分配路径上清零的次数
+};
+
+// 预清零页池。池中页除了开头的 struct run 链接外全为 0。
+struct zpool {
+  struct spinlock lock;
+  struct run *freelist;
+  int count;
+};
+
+struct {
+  struct spinlock lock;   // 保护 free_area 和 nfree
+  struct run *free_area[MAXORDER+1];  // 每一阶的空闲块链表
+  int nfree;              // 伙伴系统中的空闲页数
+  struct kcache cache[NCPU];
+  struct zpool zpool;
 } kmem;
 
 void
 kinit()
 {
-  freerange(end, (void*)PHYSTOP);
+  uint64 npages = (PHYSTOP - KERNBASE) / PGSIZE;
+  uint64 p, q;
+  int i;
+
+  initlock(&kmem.lock, "kmem");
+  initlock(&kmem.zpool.lock, "kzero");
+
+  pages = (struct page*)PGROUNDUP((uint64)end);
+  memset(pages, 0, npages * sizeof(struct page));
+  freestart = (char*)PGROUNDUP((uint64)(pages + npages));
+
+  // 跳过设备树给出的保留区域（包括设备树本身）
+  for(p = (uint64)freestart; p < PHYSTOP; p = q){
+    q = PHYSTOP;
+    for(i = 0; i < fdt_nresv; i++){
+      if(fdt_resv[i].start <= p && p < fdt_resv[i].end)
+        break;
+      if(p < fdt_resv[i].start && fdt_resv[i].start < q)
+        q = fdt_resv[i].start;
+    }
+    if(i < fdt_nresv)
+      q = fdt_resv[i].end;
+    else
+      freerange((void*)p, (void*)q);
+  }
+}
+
+// 把块 r 挂到 order 阶的空闲链表上。调用者持有 kmem.lock。
+static void
+buddy_insert(struct run *r, int order)
+{
+  struct page *pg = PA2PG(r);
+
+  pg->free = 1;
+  pg->order = order;
+  r->prev = 0;
+  r->next = kmem.free_area[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free_area[order] = r;
+  kmem.nfree += 1 << order;
+}
+
+// 把块 r 从 order 阶的空闲链表上摘除。调用者持有 kmem.lock。
+static void
+buddy_remove(struct run *r, int order)
+{
+  PA2PG(r)->free = 0;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free_area[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree -= 1 << order;
+}
+
+// 分配一个 2^order 页的块，必要时拆分更大的块。
+// 调用者持有 kmem.lock。失败返回 0。
+static void *
+buddy_alloc(int order)
+{
+  struct run *r;
+  int o;
+
+  for(o = order; o <= MAXORDER; o++)
+    if(kmem.free_area[o])
+      break;
+  if(o > MAXORDER)
+    return 0;
+
+  r = kmem.free_area[o];
+  buddy_remove(r, o);
+
+  // 把多余的后半部分逐级挂回空闲链表
+  while(o > order){
+    o--;
+    buddy_insert((struct run*)((char*)r + ((uint64)PGSIZE << o)), o);
+  }
+  PA2PG(r)->order = order;
+  return (void*)r;
+}
+
+// 释放一个 2^order 页的块，并尽可能与伙伴合并。
+// 调用者持有 kmem.lock。
+static void
+buddy_free(uint64 pa, int order)
+{
+  uint64 buddy;
+  struct page *bp;
+
+  if(PA2PG(pa)->free)
+    panic("buddy_free: double free");
+
+  while(order < MAXORDER){
+    buddy = pa ^ ((uint64)PGSIZE << order);
+    if(buddy < KERNBASE || buddy >= PHYSTOP)
+      break;
+    bp = PA2PG(buddy);
+    if(!bp->free || bp->order != order)
+      break;
+    buddy_remove((struct run*)buddy, order);
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  buddy_insert((struct run*)pa, order);
 }
 
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE) {
-    memset(p, 0, PGSIZE); // clear memory before adding to freelist
-    kfree(p);
+  uint64 p, size;
+  int order;
+
+  p = PGROUNDUP((uint64)pa_start);
+  acquire(&kmem.lock);
+  while(p + PGSIZE <= (uint64)pa_end){
+    // 尽可能放入最大的、自然对齐的块
+    for(order = MAXORDER; order > 0; order--){
+      size = (uint64)PGSIZE << order;
+      if((p & (size - 1)) == 0 && p + size <= (uint64)pa_end)
+        break;
+    }
+    buddy_free(p, order);
+    p += (uint64)PGSIZE << order;
   }
+  release(&kmem.lock);
+}
+
+// 从伙伴系统批量取出最多 KCACHE_BATCH 个单页放入本地缓存。
+// 调用者必须已经关中断（push_off）。
+static void
+kcache_refill(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHE_BATCH && (r = buddy_alloc(0)) != 0; n++){
+    r->next = kc->freelist;
+    kc->freelist = r;
+  }
+  release(&kmem.lock);
+  kc->count += n;
+  // 空闲页快用完了，让 kswapd 换出一些用户页
+  if(kmem.nfree < SWAP_LOW)
+    swap_kick();
+}
+
+// 把本地缓存中的 KCACHE_BATCH 个页归还到伙伴系统。
+// 调用者必须已经关中断（push_off）。
+static void
+kcache_drain(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHE_BATCH && (r = kc->freelist) != 0; n++){
+    kc->freelist = r->next;
+    buddy_free((uint64)r, 0);
+  }
+  release(&kmem.lock);
+  kc->count -= n;
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -42,25 +252,104 @@ void
 kfree(void *pa)
 {
   struct run *r;
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  struct kcache *kc;
+  struct page *pg;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < freestart || (uint64)pa >= PHYSTOP)
     panic("kfree");
   
-  // 检查是否已经在 freelist 中 (double free 检测)
-  // for(r = kmem.freelist; r != 0; r = r->next) {
-  //   if(r == (struct run*)pa) {
-  //     printf("PANIC: double free detected at %x\n", pa);
-  //     panic("kfree: double free");
-  //   }
-  // }
-  
   // Fill with junk to catch dangling refs.
   // memset(pa, 1, PGSIZE);
 
+  // 还有其他引用（COW 共享）时只减少计数
+  pg = PA2PG(pa);
+  if(pg->ref == 0)
+    panic("kfree: ref");
+  if(__atomic_sub_fetch(&pg->ref, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
   r = (struct run*)pa;
 
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  // printf("kfree end\n");
+  push_off();
+  kc = &kmem.cache[cpuid()];
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->count++;
+  if(kc->count >= KCACHE_HIGH)
+    kcache_drain(kc);
+  pop_off();
+}
+
+// 从零页池批量取出最多 KCACHE_BATCH 个零页放入本地缓存。先不加锁
+// 看一眼池中有没有页，池空时不碰全局的池锁。
+// 调用者必须已经关中断（push_off）。
+static void
+zcache_refill(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  if(kmem.zpool.count == 0)
+    return;
+  acquire(&kmem.zpool.lock);
+  for(n = 0; n < KCACHE_BATCH && (r = kmem.zpool.freelist) != 0; n++){
+    kmem.zpool.freelist = r->next;
+    r->next = kc->zfree;
+    kc->zfree = r;
+  }
+  kmem.zpool.count -= n;
+  release(&kmem.zpool.lock);
+  kc->zcount += n;
+}
+
+// 从零页池取一页，池空返回 0
+static struct run*
+zpool_get(void)
+{
+  struct run *r;
+
+  acquire(&kmem.zpool.lock);
+  if((r = kmem.zpool.freelist) != 0){
+    kmem.zpool.freelist = r->next;
+    kmem.zpool.count--;
+  }
+  release(&kmem.zpool.lock);
+  return r;
+}
+
+// Allocate one 4096-byte page of physical memory without
+// clearing it. For callers that overwrite the whole page.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_nozero(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  push_off();
+  kc = &kmem.cache[cpuid()];
+  if(kc->freelist){
+    kc->hits++;
+  } else {
+    kc->misses++;
+    kcache_refill(kc);
+  }
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->count--;
+  } else if((r = kc->zfree) != 0){
+    // 内存耗尽时，零页也可以用
+    kc->zfree = r->next;
+    kc->zcount--;
+  }
+  pop_off();
+
+  if(r == 0)
+    r = zpool_get();
+  if(r)
+    PA2PG(r)->ref = 1;
+  return (void*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,11 +359,189 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  r = kmem.freelist;
-  if(r) {
-    kmem.freelist = r->next;
-    memset((char*)r, 0, PGSIZE); // clear allocated memory
+  push_off();
+  kc = &kmem.cache[cpuid()];
+  if(kc->zfree == 0)
+    zcache_refill(kc);
+  if((r = kc->zfree) != 0){
+    kc->zfree = r->next;
+    kc->zcount--;
+    kc->zhits++;
+  } else {
+    kc->zmisses++;
+  }
+  pop_off();
+
+  if(r){
+    PA2PG(r)->ref = 1;
+    memset((char*)r, 0, sizeof(struct run)); // 只有链接字段不为 0
+    return (void*)r;
   }
+
+  r = kalloc_nozero();
+  if(r)
+    memset((char*)r, 0, PGSIZE); // clear allocated memory
   return (void*)r;
 }
+
+// 空闲页总数：伙伴系统、各CPU缓存和零页池中的页。只用于水位判断，
+// 不加锁读取。
+int
+kfreepages(void)
+{
+  int n = kmem.nfree + kmem.zpool.count;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kmem.cache[i].count + kmem.cache[i].zcount;
+  return n;
+}
+
+// 零页池未满时唤醒 kzerod。由调度器在找不到可运行进程时调用。
+void
+kzero_kick(void)
+{
+  if(kmem.zpool.count < ZPOOL_LOW && kmem.nfree > SWAP_HIGH)
+    wakeup(&kmem.zpool);
+}
+
+// 预清零内核线程，以空闲优先级运行：每清零一页就让出CPU，
+// 调度器只在没有其他可运行进程时才会选中它。空闲页不超过
+// SWAP_HIGH 时不再取页，免得为了填池让 kswapd 换出用户页。
+void
+kzerod(void)
+{
+  char *pa;
+
+  for(;;){
+    while(kmem.zpool.count < ZPOOL_HIGH && kmem.nfree > SWAP_HIGH){
+      if((pa = kalloc_nozero()) == 0)
+        break;
+      memset(pa, 0, PGSIZE);
+      acquire(&kmem.zpool.lock);
+      ((struct run*)pa)->next = kmem.zpool.freelist;
+      kmem.zpool.freelist = (struct run*)pa;
+      kmem.zpool.count++;
+      release(&kmem.zpool.lock);
+      yield();
+    }
+    sleep(&kmem.zpool);
+  }
+}
+
+// 分配 2^order 个物理上连续的页，起始地址按块大小自然对齐。
+// order 为 0 时走 kalloc() 的每CPU快速路径。
+// 返回清零后的内存，失败返回 0。
+void *
+kalloc_pages(int order)
+{
+  void *pa;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pa){
+    PA2PG(pa)->ref = 1;
+    memset(pa, 0, (uint64)PGSIZE << order);
+  }
+  return pa;
+}
+
+// 释放由 kalloc_pages(order) 分配的块
+void
+kfree_pages(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages: order");
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa & (((uint64)PGSIZE << order) - 1)) != 0 ||
+     (char*)pa < freestart || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  PA2PG(pa)->ref = 0;
+  acquire(&kmem.lock);
+  buddy_free((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// 增加页 pa 的引用计数
+void
+kref_inc(void *pa)
+{
+  struct page *pg;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < freestart || (uint64)pa >= PHYSTOP)
+    panic("kref_inc");
+  pg = PA2PG(pa);
+  if(pg->ref == 0)
+    panic("kref_inc: free page");
+  __atomic_add_fetch(&pg->ref, 1, __ATOMIC_ACQ_REL);
+}
+
+// 返回页 pa 当前的引用计数
+int
+kref_get(void *pa)
+{
+  return __atomic_load_n(&PA2PG(pa)->ref, __ATOMIC_ACQUIRE);
+}
+
+// order 阶空闲链表上的块数。调用者持有 kmem.lock。
+static int
+buddy_count(int order)
+{
+  struct run *r;
+  int n = 0;
+
+  for(r = kmem.free_area[order]; r; r = r->next)
+    n++;
+  return n;
+}
+
+// 返回伙伴系统中 order 阶的空闲块数，用于测试合并
+int
+kfree_blocks(int order)
+{
+  int n;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  n = buddy_count(order);
+  release(&kmem.lock);
+  return n;
+}
+
+// 打印各CPU页缓存的命中/未命中统计，用于调整 KCACHE_BATCH
+void
+kmem_stats(void)
+{
+  struct kcache *kc;
+  int n;
+
+  acquire(&kmem.lock);
+  printf("[KMEM] buddy free pages: %d, batch=%d, high=%d\n",
+         kmem.nfree, KCACHE_BATCH, KCACHE_HIGH);
+  for(int o = 0; o <= MAXORDER; o++){
+    n = buddy_count(o);
+    if(n)
+      printf("[KMEM]   order %d: %d blocks\n", o, n);
+  }
+  release(&kmem.lock);
+  for(int i = 0; i < NCPU; i++){
+    kc = &kmem.cache[i];
+    printf("[KMEM] cpu%d: cached=%d hits=%d misses=%d zero=%d zhits=%d zmisses=%d\n",
+           i, kc->count, (int)kc->hits, (int)kc->misses,
+           kc->zcount, (int)kc->zhits, (int)kc->zmisses);
+  }
+  printf("[KMEM] zero pool: %d pages\n", kmem.zpool.count);
+}
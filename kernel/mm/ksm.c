@@ -0,0 +1,198 @@
+// Kernel same-page merging.
+//
+// ksmd 定期用 uvm_scan_next() 扫描用户进程的私有页，把内容相同的
+// 页合并成一个只读的 COW 页：各进程的表项指向同一物理页并打上
+// PTE_COW，写入时由 cowfault() 复制出私有页，和 fork 共享的页完全
+// 一样处理。
+//
+// 只考虑只被映射一次（引用计数为 1）的页。按 memsum() 的校验和
+// 分桶，同一桶内再逐字节比较。已合并的页放在 stable 表中，表项
+// 本身持有一个引用，因此合并页的引用数至少为 2，不会被 cowfault()
+// 原地改为可写，内容不会再变。第一次见到的页放在 unstable 表中，
+// 只记下所在的进程和地址，下次有内容相同的页时再检查它是否还在
+// 原处、内容是否未变，然后把它提升为合并页。unstable 表每扫完一圈
+// 清空一次；stable 表中只剩自己引用的页在这时释放。
+//
+// 检查和修改表项时持有所属进程的 p->lock，它不会在中间开始运行，
+// 正在其他CPU上运行的进程不扫描（见 proc_next_user）。
+
+#include "../include/def.h"
+#include "../proc/proc.h"
+
+struct ksm_node {
+  struct ksm_node *next;
+  uint64 sum;     // 页内容的校验和
+  uint64 pa;
+  int pid;        // unstable 表：页所在的进程和地址
+  uint64 va;
+};
+
+static struct {
+  struct kmem_cache *cache;
+  struct ksm_node *stable[KSM_HASH];
+  struct ksm_node *unstable[KSM_HASH];
+  struct uvm_scan scan;
+} ksm;
+
+void
+ksminit(void)
+{
+  if((ksm.cache = kmem_cache_create("ksm_node", sizeof(struct ksm_node), 0)) == 0)
+    panic("ksminit");
+}
+
+// 让 p 的表项 pte 改为映射合并页 spa，释放原来的页
+static void
+ksm_merge(struct proc *p, pte_t *pte, uint64 spa)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+
+  if(flags & (PTE_W|PTE_COW))
+    flags = (flags & ~PTE_W) | PTE_COW;
+  kref_inc((void*)spa);
+  *pte = PA2PTE(spa) | flags;
+  uvm_flushproc(p);
+  kfree((void*)pa);
+}
+
+// unstable 表中的页 n 如果还映射在原处，返回它的表项和进程。
+// cur 是正在扫描的进程，调用者已持有它的锁；返回其他进程时
+// 该进程已加锁，由调用者释放。
+static pte_t*
+ksm_lookup(struct ksm_node *n, struct proc *cur, struct proc **pp)
+{
+  struct proc *p;
+  pte_t *pte;
+
+  if((p = find_proc_by_pid(n->pid)) == 0)
+    return 0;
+  if(p != cur){
+    acquire(&p->lock);
+    if((p->state != RUNNABLE && p->state != SLEEPING) || p->pagetable == 0){
+      release(&p->lock);
+      return 0;
+    }
+  }
+  pte = walk(p->pagetable, n->va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+     PTE2PA(*pte) != n->pa || kref_get((void*)n->pa) != 1){
+    if(p != cur)
+      release(&p->lock);
+    return 0;
+  }
+  *pp = p;
+  return pte;
+}
+
+// 处理扫描到的一页：和已合并的页或本圈见过的页合并，否则记入
+// unstable 表
+static void
+ksm_page(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte), sum;
+  struct ksm_node *n, **np;
+  struct proc *q;
+  pte_t *qpte;
+  int h;
+
+  if(kref_get((void*)pa) != 1)
+    return;
+  sum = memsum((void*)pa, PGSIZE);
+  h = sum % KSM_HASH;
+
+  for(n = ksm.stable[h]; n; n = n->next){
+    if(n->sum == sum && memcmp((void*)n->pa, (void*)pa, PGSIZE) == 0){
+      ksm_merge(p, pte, n->pa);
+      return;
+    }
+  }
+
+  for(np = &ksm.unstable[h]; (n = *np) != 0; np = &n->next){
+    if(n->sum != sum || n->pa == pa)
+      continue;
+    if((qpte = ksm_lookup(n, p, &q)) == 0)
+      continue;
+    if(memcmp((void*)n->pa, (void*)pa, PGSIZE) != 0){
+      if(q != p)
+        release(&q->lock);
+      continue;
+    }
+    // 提升为合并页：原来的映射也改成只读 COW，节点持有一个引用
+    *np = n->next;
+    if(*qpte & (PTE_W|PTE_COW))
+      *qpte = (*qpte & ~PTE_W) | PTE_COW;
+    uvm_flushproc(q);
+    if(q != p)
+      release(&q->lock);
+    kref_inc((void*)n->pa);
+    n->next = ksm.stable[h];
+    ksm.stable[h] = n;
+    ksm_merge(p, pte, n->pa);
+    return;
+  }
+
+  if((n = kmem_cache_alloc(ksm.cache)) == 0)
+    return;
+  n->sum = sum;
+  n->pa = pa;
+  n->pid = p->pid;
+  n->va = va;
+  n->next = ksm.unstable[h];
+  ksm.unstable[h] = n;
+}
+
+// 扫完一圈：清空 unstable 表，释放不再被映射的合并页，更新统计
+static void
+ksm_endpass(void)
+{
+  struct ksm_node *n, **np;
+  uint64 shared = 0, sharing = 0;
+  int r;
+
+  for(int i = 0; i < KSM_HASH; i++){
+    while((n = ksm.unstable[i]) != 0){
+      ksm.unstable[i] = n->next;
+      kmem_cache_free(ksm.cache, n);
+    }
+    for(np = &ksm.stable[i]; (n = *np) != 0; ){
+      if((r = kref_get((void*)n->pa)) == 1){
+        *np = n->next;
+        kfree((void*)n->pa);
+        kmem_cache_free(ksm.cache, n);
+        continue;
+      }
+      shared++;
+      sharing += r - 2;   // 除去节点自己和保留的一份，省下的页数
+      np = &n->next;
+    }
+  }
+  kstat_inc(KSTAT_KSM_PASSES);
+  kstat_set(KSTAT_KSM_SHARED, shared);
+  kstat_set(KSTAT_KSM_SAVED, sharing);
+}
+
+// 合并扫描线程：每隔 KSM_INTERVAL 扫描 KSM_BATCH 个页
+void
+ksmd(void)
+{
+  struct proc *p;
+  uint64 va;
+  pte_t *pte;
+
+  for(;;){
+    for(int i = 0; i < KSM_BATCH; i++){
+      acquire(&proc_lock);
+      if((p = uvm_scan_next(&ksm.scan, &va, &pte)) != 0){
+        ksm_page(p, va, pte);
+        release(&p->lock);
+      } else
+        ksm_endpass();
+      release(&proc_lock);
+      if(p == 0)
+        break;
+    }
+    kstat_set(KSTAT_KSM_SCANNED, ksm.scan.scanned);
+    sleep_ticks(KSM_INTERVAL);
+  }
+}
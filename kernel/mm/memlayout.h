@@ -14,7 +14,7 @@
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
-// end -- start of kernel page allocation area
+// end -- struct page array, then the kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
@@ -25,6 +25,10 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
 
+// second virtio-mmio slot, used for the swap disk
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
+
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -36,8 +40,16 @@
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
+// PHYSTOP 在启动时由 fdtinit() 根据设备树中的 /memory 节点确定，
+// 没有设备树时为 PHYSTOP_DEFAULT；最多到 PHYSTOP_MAX，内核直接
+// 映射不能和用户的 mmap 区域重叠。
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSTOP_DEFAULT (KERNBASE + 128*1024*1024)
+#define PHYSTOP_MAX MMAPBASE
+#ifndef __ASSEMBLER__
+extern uint64 phystop;
+#endif
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -51,9 +63,17 @@
 // Address zero first:
 //   text
 //   original data and bss
-//   fixed-size stack
-//   expandable heap
+//   expandable heap (below KERNBASE)
 //   ...
+//   mmap regions (MMAPBASE..MMAPTOP, allocated top-down)
+//   unmapped gap
+//   stack (grows down from USTACKTOP, at most USTACKMAX bytes)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USTACKTOP TRAPFRAME
+
+// mmap() 选择的地址位于内核直接映射（最多到 PHYSTOP_MAX）之上，
+// 与堆和 TRAPFRAME 之间各留出空隙
+#define MMAPBASE 0x200000000L
+#define MMAPTOP (USTACKTOP - USTACKMAX - PGSIZE)
@@ -0,0 +1,138 @@
+// Per-process memory statistics and working-set sampling.
+//
+// 扫描线程 kwsd 每隔 WS_INTERVAL 走一遍每个用户进程的页表：
+// 统计驻留页（rss）、换出的页（swapped），以及上一个周期内被访问
+// （PTE_A）和被写过（PTE_D）的页，分别作为工作集大小（wss）和
+// 脏页数（dirty），然后清除这两位，让硬件重新记录。
+// 扫描到时正在其他CPU上运行的进程保留上一次的结果。
+//
+// 清除的 A 位转存到软件位 PTE_REF，kswapd 的时钟算法把两者都当作
+// "最近访问过"，采样不会让回收变得更激进。共享文件映射的 D 位决定
+// 解除映射时是否写回（vma_unmap），只统计不清除。
+//
+// 缺页次数（minflt/majflt）由 vmfault() 实时累计。统计结果由
+// memstat 系统调用读出。
+
+#include "../include/def.h"
+#include "../proc/proc.h"
+
+// 扫描 p 中 [start, end) 所在的一张末级页表，结果累加到 st。
+// 调用者持有 p->lock。返回是否清除了 A/D 位。
+static int
+ws_table(struct proc *p, uint64 start, uint64 end, int shared, struct memstat *st)
+{
+  pte_t *pte;
+  uint64 va;
+  int cleared = 0;
+
+  for(va = start; va < end; va += PGSIZE){
+    if((pte = walk(p->pagetable, va, 0)) == 0)
+      continue;
+    if((*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP){
+      st->swapped++;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    st->rss++;
+    if(*pte & PTE_A){
+      st->wss++;
+      *pte = (*pte & ~PTE_A) | PTE_REF;
+      cleared = 1;
+    }
+    if(*pte & PTE_D){
+      st->dirty++;
+      if(!shared){
+        *pte &= ~PTE_D;
+        cleared = 1;
+      }
+    }
+  }
+  return cleared;
+}
+
+// 扫描进程 pid 的整个地址空间，每次持有 p->lock 处理一张末级
+// 页表，其间进程可能已经退出或正在运行，每次都重新查找。
+static void
+ws_proc(int pid)
+{
+  struct memstat st;
+  struct proc *p;
+  uint64 va = 0, start, end, stop;
+  pte_t *pde;
+  int flags;
+
+  memset(&st, 0, sizeof(st));
+  for(;;){
+    acquire(&proc_lock);
+    if((p = proc_next_user(pid)) == 0){
+      release(&proc_lock);
+      return;
+    }
+    if(p->pid != pid){
+      release(&p->lock);
+      release(&proc_lock);
+      return;
+    }
+    if((flags = uvm_range(p, va, &start, &end, 0)) == 0){
+      p->mstat.rss = st.rss;
+      p->mstat.wss = st.wss;
+      p->mstat.dirty = st.dirty;
+      p->mstat.swapped = st.swapped;
+      release(&p->lock);
+      release(&proc_lock);
+      return;
+    }
+    stop = (start + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+    if(stop > end)
+      stop = end;
+    pde = walklevel(p->pagetable, start, 1, 0);
+    if(pde && (*pde & PTE_V) &&
+       ws_table(p, start, stop, flags & MAP_SHARED, &st))
+      uvm_flushproc(p);
+    va = stop;
+    release(&p->lock);
+    release(&proc_lock);
+  }
+}
+
+// 工作集扫描线程
+void
+kwsd(void)
+{
+  struct proc *p;
+  int pid;
+
+  for(;;){
+    for(pid = 0; ; pid++){
+      acquire(&proc_lock);
+      p = proc_next_user(pid);
+      if(p){
+        pid = p->pid;
+        release(&p->lock);
+      }
+      release(&proc_lock);
+      if(p == 0)
+        break;
+      ws_proc(pid);
+    }
+    sleep_ticks(WS_INTERVAL);
+  }
+}
+
+// 取进程 pid（0 表示当前进程）的内存统计。没有这个进程返回 -1。
+int
+memstat(int pid, struct memstat *st)
+{
+  struct proc *p;
+
+  acquire(&proc_lock);
+  p = pid == 0 ? myproc() : find_proc_by_pid(pid);
+  if(p == 0 || p->state == UNUSED){
+    release(&proc_lock);
+    return -1;
+  }
+  *st = p->mstat;
+  release(&proc_lock);
+  return 0;
+}
@@ -0,0 +1,211 @@
+// Page cache for file pages.
+//
+// 以 (dev, inum, 页对齐的文件偏移) 为键缓存文件内容的物理页，页中
+// 超出文件末尾的部分为零。exec 装入的段和 mmap 的文件映射都映射
+// 这些页：运行同一个程序的所有进程把同一段映射到同一组物理页上，
+// 同一文件页的所有共享映射也总是同一个物理页。
+//
+// 缓存本身持有页的一个引用，每个映射该页的进程再各持有一个
+// （kref_inc），进程解除映射（uvmunmap / proc_freepagetable）时
+// 由 kfree 减少。引用计数只剩 1 的页没有进程在用，是干净的，
+// 可以随时由 pcache_reclaim() 丢弃，需要时再从文件读入。内存不足
+// 时 kalloc_user() 和 kswapd 先回收这些页，再换出匿名页。
+//
+// 共享文件映射（MAP_SHARED）直接映射缓存页，所以缓存页必须和文件
+// 保持一致：writei() 写文件时用 pcache_write() 原地更新缓存页，
+// 文件被截断时 pcache_invalidate() 只丢弃没有进程映射的页，仍被
+// 映射的页清零后留在缓存中，之后的映射者和写入都还落在同一页上。
+
+#include "../include/def.h"
+#include "../utils/spinlock.h"
+#include "../utils/sleeplock.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+
+#define NPCHASH 256
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint64 off;             // 页首对应的文件偏移，按页对齐
+  char *pa;
+  struct pcpage *next;    // 哈希链
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct pcpage *hash[NPCHASH];
+  int npages;
+  int hand;               // pcache_reclaim() 下一次从这条链开始
+} pcache;
+
+// 按 inode 和页号散列，pcache_write() 每写一块只需查一条短链
+#define PCHASH(dev, inum, off) \
+  (((dev) * 31 + (inum) * 17 + ((off) >> PGSHIFT)) % NPCHASH)
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("pcpage", sizeof(struct pcpage), 0);
+  if(pcache.cache == 0)
+    panic("pcacheinit");
+}
+
+// 查找缓存页。调用者持有 pcache.lock。
+static struct pcpage*
+pcache_lookup(uint dev, uint inum, uint64 off)
+{
+  struct pcpage *pc;
+
+  for(pc = pcache.hash[PCHASH(dev, inum, off)]; pc; pc = pc->next)
+    if(pc->dev == dev && pc->inum == inum && pc->off == off)
+      return pc;
+  return 0;
+}
+
+// 返回文件 ip 中从 off（按页对齐）开始的一页内容所在的物理页，
+// 并为调用者增加一个引用，调用者用 kfree 释放。不在缓存中时从
+// 文件读入。失败返回 0。
+char*
+pcache_get(struct inode *ip, uint64 off)
+{
+  struct pcpage *pc, *old;
+  char *pa;
+  uint n;
+
+  if(off % PGSIZE != 0)
+    panic("pcache_get");
+
+  acquire(&pcache.lock);
+  if((pc = pcache_lookup(ip->dev, ip->inum, off)) != 0){
+    kref_inc(pc->pa);
+    pa = pc->pa;
+    release(&pcache.lock);
+    kstat_inc(KSTAT_PCACHE_HIT);
+    return pa;
+  }
+  release(&pcache.lock);
+  kstat_inc(KSTAT_PCACHE_MISS);
+
+  if((pa = kalloc_nozero()) == 0 &&
+     (pcache_reclaim(SWAP_BATCH) == 0 || (pa = kalloc_nozero()) == 0))
+    return 0;
+  if((pc = kmem_cache_alloc(pcache.cache)) == 0){
+    kfree(pa);
+    return 0;
+  }
+
+  // 在持有 inode 锁期间读入并插入，保证不会与 pcache_write 和
+  // pcache_invalidate 交错
+  ilock(ip);
+  n = 0;
+  if(off < ip->size)
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+  if(readi(ip, 0, (uint64)pa, off, n) != n){
+    iunlock(ip);
+    kmem_cache_free(pcache.cache, pc);
+    kfree(pa);
+    return 0;
+  }
+  memset(pa + n, 0, PGSIZE - n);
+
+  acquire(&pcache.lock);
+  if((old = pcache_lookup(ip->dev, ip->inum, off)) != 0){
+    // 别的进程在我们读入期间抢先插入了同一页：用缓存中的那页，
+    // 否则共享映射会落在不同的物理页上
+    kfree(pa);
+    pa = old->pa;
+    kref_inc(pa);
+    release(&pcache.lock);
+    iunlock(ip);
+    kmem_cache_free(pcache.cache, pc);
+    return pa;
+  }
+  pc->dev = ip->dev;
+  pc->inum = ip->inum;
+  pc->off = off;
+  pc->pa = pa;
+  pc->next = pcache.hash[PCHASH(pc->dev, pc->inum, off)];
+  pcache.hash[PCHASH(pc->dev, pc->inum, off)] = pc;
+  pcache.npages++;
+  kref_inc(pa);   // 缓存持有的引用
+  release(&pcache.lock);
+  iunlock(ip);
+  return pa;
+}
+
+// 文件 ip 中 [off, off+n) 被写成 src 开始的内容，更新缓存页中对应
+// 的部分。由 writei 对每个写入的块调用，调用者持有 ip->lock。
+// 按页查找，不扫描该文件的所有缓存页。
+void
+pcache_write(struct inode *ip, uint64 off, char *src, uint n)
+{
+  struct pcpage *pc;
+  uint64 a, e;
+
+  acquire(&pcache.lock);
+  for(; n > 0; off += e, src += e, n -= e){
+    a = PGROUNDDOWN(off);
+    e = a + PGSIZE - off < n ? a + PGSIZE - off : n;
+    if((pc = pcache_lookup(ip->dev, ip->inum, a)) != 0)
+      memmove(pc->pa + (off - a), src, e);
+  }
+  release(&pcache.lock);
+}
+
+// 文件 ip 被截断：丢弃没有进程映射的缓存页，仍被映射的页清零。
+// 调用者持有 ip->lock。
+void
+pcache_invalidate(struct inode *ip)
+{
+  struct pcpage *pc, **pp;
+  uint64 off;
+
+  // 缓存页只为文件末尾之前的偏移建立，逐页查找即可
+  acquire(&pcache.lock);
+  for(off = 0; off < ip->size; off += PGSIZE){
+    for(pp = &pcache.hash[PCHASH(ip->dev, ip->inum, off)]; (pc = *pp) != 0; pp = &pc->next)
+      if(pc->dev == ip->dev && pc->inum == ip->inum && pc->off == off)
+        break;
+    if(pc == 0)
+      continue;
+    if(kref_get(pc->pa) > 1){
+      memset(pc->pa, 0, PGSIZE);
+    } else {
+      *pp = pc->next;
+      kfree(pc->pa);
+      kmem_cache_free(pcache.cache, pc);
+      pcache.npages--;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// 丢弃最多 target 个没有进程映射的缓存页，返回释放的页数。
+// 像时钟指针一样从上次停下的哈希链继续，各文件的页轮流被回收。
+int
+pcache_reclaim(int target)
+{
+  struct pcpage *pc, **pp;
+  int i, n = 0;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCHASH && n < target; i++){
+    pcache.hand = (pcache.hand + 1) % NPCHASH;
+    for(pp = &pcache.hash[pcache.hand]; (pc = *pp) != 0 && n < target; ){
+      if(kref_get(pc->pa) == 1){
+        *pp = pc->next;
+        kfree(pc->pa);
+        kmem_cache_free(pcache.cache, pc);
+        pcache.npages--;
+        n++;
+      } else {
+        pp = &pc->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
@@ -0,0 +1,242 @@
+// Slab object allocator.
+//
+// 在 kalloc_pages() 之上为固定大小的内核对象（proc、file、inode、buf
+// 等）提供对象缓存 kmem_cache。每个 slab 是一个自然对齐的 2^order 页
+// 块，块首放 struct slab 头和空闲对象下标栈，后面是对象数组；由于
+// 块按大小对齐，对象地址向下取整即可找到所属 slab。
+//
+// 构造函数只在 slab 创建时对每个对象调用一次，对象释放时应保持
+// 构造后的状态（例如已初始化的睡眠锁），因此空闲链表不占用对象
+// 本身的空间。
+//
+// 每个CPU有一个小的对象数组缓存，分配/释放优先在本地完成，
+// 只有本地缓存空了或满了才成批地与 slab 链表交换。
+
+#include "../include/def.h"
+#include "../utils/spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  struct kmem_cache *cache;
+  char *objs;          // 第一个对象的地址
+  int inuse;           // 已分配出去的对象数
+  int nfree;           // free[] 中有效的下标个数
+  ushort free[];       // 空闲对象下标栈
+};
+
+static struct kmem_cache cache_cache;   // 用来分配 struct kmem_cache 本身
+static struct kmem_cache *caches;       // 所有对象缓存，用于统计
+
+static void
+list_add(struct slab **head, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+static void
+list_del(struct slab **head, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// 计算 2^order 页的 slab 能放下多少个对象
+static int
+slab_capacity(uint size, int order)
+{
+  uint64 slabsize = (uint64)PGSIZE << order;
+  int n;
+
+  n = (slabsize - sizeof(struct slab)) / (size + sizeof(ushort));
+  while(n > 0 && SLAB_ALIGN(sizeof(struct slab) + n*sizeof(ushort)) + (uint64)n*size > slabsize)
+    n--;
+  return n;
+}
+
+static void
+cache_init(struct kmem_cache *c, char *name, uint size, void (*ctor)(void *))
+{
+  int order;
+
+  size = SLAB_ALIGN(size);
+  for(order = 0; order < SLAB_MAXORDER; order++)
+    if(slab_capacity(size, order) >= SLAB_MINOBJS)
+      break;
+  if(slab_capacity(size, order) < 1)
+    panic("kmem_cache_create: object too large");
+
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->order = order;
+  c->nper = slab_capacity(size, order);
+  c->ctor = ctor;
+  c->next = caches;
+  caches = c;
+}
+
+// 创建一个对象缓存。ctor 可以为 0。
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void *))
+{
+  struct kmem_cache *c;
+
+  if(cache_cache.size == 0)
+    cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0);
+
+  if((c = kmem_cache_alloc(&cache_cache)) == 0)
+    return 0;
+  cache_init(c, name, size, ctor);
+  return c;
+}
+
+// 分配并初始化一个新的 slab。调用者持有 c->lock。
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  int i;
+
+  if((s = kalloc_pages(c->order)) == 0)
+    return 0;
+  s->cache = c;
+  s->objs = (char*)s + SLAB_ALIGN(sizeof(struct slab) + c->nper*sizeof(ushort));
+  s->inuse = 0;
+  s->nfree = c->nper;
+  for(i = 0; i < c->nper; i++){
+    s->free[i] = c->nper - 1 - i;
+    if(c->ctor)
+      c->ctor(s->objs + (uint64)i*c->size);
+  }
+  c->nslabs++;
+  list_add(&c->empty, s);
+  return s;
+}
+
+// 从 slab 链表中取出最多 n 个对象放入 objs[]，返回实际个数。
+// 调用者持有 c->lock。
+static int
+slab_take(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  int got = 0;
+
+  while(got < n){
+    if((s = c->partial) == 0){
+      if((s = c->empty) == 0 && (s = slab_grow(c)) == 0)
+        break;
+      list_del(&c->empty, s);
+      list_add(&c->partial, s);
+    }
+    while(got < n && s->nfree > 0){
+      objs[got++] = s->objs + (uint64)s->free[--s->nfree] * c->size;
+      s->inuse++;
+    }
+    if(s->nfree == 0){
+      list_del(&c->partial, s);
+      list_add(&c->full, s);
+    }
+  }
+  c->nactive += got;
+  return got;
+}
+
+// 把对象归还给所属 slab。调用者持有 c->lock。
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  uint64 idx;
+
+  s = (struct slab*)((uint64)obj & ~(((uint64)PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  idx = ((char*)obj - s->objs) / c->size;
+  if(idx >= c->nper || s->objs + idx*c->size != (char*)obj)
+    panic("kmem_cache_free: bad object");
+
+  if(s->nfree == 0){
+    list_del(&c->full, s);
+    list_add(&c->partial, s);
+  }
+  s->free[s->nfree++] = idx;
+  s->inuse--;
+  c->nactive--;
+
+  if(s->inuse == 0){
+    list_del(&c->partial, s);
+    // 只保留一个空 slab 作为缓冲，多余的还给伙伴系统
+    if(c->empty){
+      c->nslabs--;
+      kfree_pages(s, c->order);
+    } else {
+      list_add(&c->empty, s);
+    }
+  }
+}
+
+// 分配一个对象。返回构造后（而非清零）的对象，失败返回 0。
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab_cpu *ac;
+  void *obj = 0;
+
+  push_off();
+  ac = &c->cpu[cpuid()];
+  if(ac->avail == 0){
+    acquire(&c->lock);
+    ac->avail = slab_take(c, ac->entry, SLAB_BATCH);
+    release(&c->lock);
+  }
+  if(ac->avail > 0)
+    obj = ac->entry[--ac->avail];
+  pop_off();
+  return obj;
+}
+
+// 释放一个对象。对象应处于构造后的状态。
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab_cpu *ac;
+
+  push_off();
+  ac = &c->cpu[cpuid()];
+  if(ac->avail == SLAB_CPUCACHE){
+    acquire(&c->lock);
+    while(ac->avail > SLAB_CPUCACHE - SLAB_BATCH)
+      slab_put(c, ac->entry[--ac->avail]);
+    release(&c->lock);
+  }
+  ac->entry[ac->avail++] = obj;
+  pop_off();
+}
+
+// 打印所有对象缓存的使用情况
+void
+kmem_cache_stats(void)
+{
+  struct kmem_cache *c;
+  int cached;
+
+  for(c = caches; c; c = c->next){
+    cached = 0;
+    for(int i = 0; i < NCPU; i++)
+      cached += c->cpu[i].avail;
+    printf("[SLAB] %s: objsize=%d order=%d per-slab=%d slabs=%d active=%d cpu-cached=%d\n",
+           c->name, c->size, c->order, c->nper, c->nslabs, c->nactive - cached, cached);
+  }
+}
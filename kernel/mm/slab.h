@@ -0,0 +1,38 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../include/type.h"
+#include "../include/param.h"
+#include "../utils/spinlock.h"
+
+#define SLAB_CPUCACHE 16   // 每CPU对象缓存容量
+#define SLAB_BATCH     8   // 每CPU缓存与 slab 链表之间一次交换的对象数
+#define SLAB_MINOBJS   8   // 选择 slab 阶时，每个 slab 至少容纳的对象数
+#define SLAB_MAXORDER  3   // slab 最大为 2^SLAB_MAXORDER 页
+#define SLAB_ALIGN(x)  (((x) + 7) & ~7UL)
+
+struct slab;
+
+// 每CPU对象缓存
+struct slab_cpu {
+  int avail;                      // entry[] 中的对象数
+  void *entry[SLAB_CPUCACHE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;           // 保护下面三个 slab 链表和计数
+  char *name;
+  uint size;                      // 对齐后的对象大小
+  int order;                      // 每个 slab 占 2^order 页
+  int nper;                       // 每个 slab 的对象数
+  void (*ctor)(void *);
+  struct slab *partial;           // 部分使用的 slab
+  struct slab *full;              // 已满的 slab
+  struct slab *empty;             // 全空的 slab（最多保留一个）
+  int nslabs;
+  int nactive;                    // 已离开 slab 链表的对象数（含每CPU缓存）
+  struct slab_cpu cpu[NCPU];
+  struct kmem_cache *next;        // 所有缓存的链表
+};
+
+#endif
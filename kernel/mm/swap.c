@@ -0,0 +1,288 @@
+// Swapping of anonymous user pages to compressed RAM and a dedicated
+// virtio disk.
+//
+// 被换出的页先尝试压缩存入内存（zram.c），放不下时才写到交换盘。
+// 交换盘是 virtio-mmio-bus.1 上的第二块 virtio 块设备，按页划分为
+// slot。被换出的页在页表中留下一个无效（PTE_V 为 0）的交换表项：
+// PTE_SWAP 加上 slot 编号和原来的权限位，硬件会忽略它，缺页时
+// vmfault() 调用 swap_in() 读回。slot 带 SWAP_ZRAM 位时低位是压缩
+// 内存中的条目下标。fork 复制交换表项时只增加 slot 的引用数
+// （swap_dup），两边各自换入后得到私有的副本。
+//
+// 回收使用时钟（second chance）算法：时钟指针按 (pid, va) 在所有
+// 用户进程的地址空间中循环，PTE_A 为 1 的页清掉 A 位再给一次机会，
+// 否则换出。工作集扫描（memstat.c）清掉的 A 位记在 PTE_REF 中，同样
+// 算作访问过。只回收只被映射一次（引用计数为 1）的用户页，页缓存中
+// 的文件页和共享映射（MAP_SHARED）中的页不回收。检查和修改表项时
+// 持有所属进程的 p->lock，它不会在中间开始运行并改动自己的页表；
+// 正在其他CPU上运行的进程不扫描。
+//
+// kalloc 在空闲页低于 SWAP_LOW 时唤醒 kswapd，由它回收到 SWAP_HIGH；
+// 进程上下文中的用户页分配失败时（kalloc_user）直接同步回收。两者
+// 都先丢弃页缓存中没有进程映射的干净页（pcache_reclaim），不够时
+// 才换出匿名页。
+// 写盘期间 slot 处于 busy 状态，此时对该页的缺页要等写完才读回。
+
+#include "../include/def.h"
+#include "../proc/proc.h"
+#include "../utils/spinlock.h"
+#include "../utils/sleeplock.h"
+
+#define SWAP_ZRAM (1L << 40)   // slot 编号中的这一位表示在压缩内存中
+
+static struct {
+  struct spinlock lock;    // 保护 ref[]、busy[] 和 hint
+  struct sleeplock rlock;  // 同一时刻只有一个回收者
+  uint64 nslots;           // 交换盘容量（页），0 表示没有交换盘
+  uchar *ref;              // 每个 slot 的引用数，0 为空闲
+  uchar *busy;             // 正在写盘的 slot
+  uint64 hint;             // 下一次从这里开始找空闲 slot
+  uint64 nused;
+  struct uvm_scan scan;    // 时钟指针
+  struct proc *kswapd;     // 回收线程，swap_kick() 直接唤醒它
+} swap;
+
+void
+swapinit(void)
+{
+  uint64 n, bytes;
+  int order;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.rlock, "swapreclaim");
+  if((n = virtio_swap_init()) == 0){
+    printf("swapinit: no swap disk, compressed RAM only\n");
+    return;
+  }
+  if(n > SWAPMAX)
+    n = SWAPMAX;
+
+  bytes = 2 * n;
+  for(order = 0; ((uint64)PGSIZE << order) < bytes; order++)
+    ;
+  if((swap.ref = kalloc_pages(order)) == 0)
+    panic("swapinit");
+  swap.busy = swap.ref + n;
+  swap.nslots = n;
+  printf("swapinit: %d pages of swap\n", (int)n);
+}
+
+// 分配一个 slot，置为 busy、引用数为 1。交换盘已满返回 -1。
+static long
+swap_alloc(void)
+{
+  uint64 i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslots; i++){
+    s = (swap.hint + i) % swap.nslots;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.hint = s + 1;
+      swap.nused++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// 释放一个交换表项对 slot 的引用
+void
+swap_free(uint64 slot)
+{
+  if(slot & SWAP_ZRAM){
+    zram_free(slot & ~SWAP_ZRAM);
+    return;
+  }
+  acquire(&swap.lock);
+  if(slot >= swap.nslots || swap.ref[slot] == 0)
+    panic("swap_free");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// fork 复制交换表项时增加 slot 的引用数
+void
+swap_dup(uint64 slot)
+{
+  if(slot & SWAP_ZRAM){
+    zram_dup(slot & ~SWAP_ZRAM);
+    return;
+  }
+  acquire(&swap.lock);
+  if(slot >= swap.nslots || swap.ref[slot] == 0 || swap.ref[slot] == 0xff)
+    panic("swap_dup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// 把 p 中的有效表项 pte 换成交换表项。先试压缩内存，成功时物理页
+// 已释放，返回 0；否则分配交换盘 slot，返回 1，由调用者在开中断后
+// 把 *pa 写到 *slot（swap_write）。都放不下返回 -1。
+// 调用者持有 p->lock，从检查表项到修改表项之间 p 不会运行。
+static int
+swap_evict(struct proc *p, pte_t *pte, uint64 *pa, long *slot)
+{
+  *pa = PTE2PA(*pte);
+  if((*slot = zram_store((void*)*pa)) >= 0){
+    *pte = SWAP2PTE(*slot | SWAP_ZRAM) | (*pte & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) | PTE_SWAP;
+    uvm_flushproc(p);
+    kfree((void*)*pa);
+    return 0;
+  }
+  if(swap.nslots == 0 || (*slot = swap_alloc()) < 0)
+    return -1;
+  *pte = SWAP2PTE(*slot) | (*pte & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) | PTE_SWAP;
+  uvm_flushproc(p);
+  return 1;
+}
+
+// 把已经从页表中摘下的页 pa 写到 slot，写完后释放物理页
+static void
+swap_write(uint64 pa, long slot)
+{
+  virtio_swap_rw((void*)pa, slot, 1);
+
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  release(&swap.lock);
+  wakeup(&swap.busy[slot]);
+
+  kfree((void*)pa);
+  kstat_inc(KSTAT_SWAP_OUT);
+}
+
+// 处理对交换表项 pte（pagetable 中 va 处）的缺页：读回页面并恢复映射。
+// 只能在进程上下文中调用，可能睡眠。
+int
+swap_in(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  pte_t old = *pte;
+  uint64 slot = PTE2SWAP(old);
+  char *mem;
+
+  if((old & (PTE_V|PTE_SWAP)) != PTE_SWAP)
+    return -1;
+
+  if(slot & SWAP_ZRAM){
+    if((mem = kalloc_user(0)) == 0)
+      return -1;
+    if(*pte != old){
+      kfree(mem);
+      return 0;
+    }
+    zram_load(slot & ~SWAP_ZRAM, mem);
+    *pte = PA2PTE(mem) | (old & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) | PTE_V;
+    swap_free(slot);
+    kstat_inc(KSTAT_ZRAM_HIT);
+    return 0;
+  }
+
+  if(slot >= swap.nslots)
+    return -1;
+  kstat_inc(KSTAT_ZRAM_MISS);
+
+  // 页还在写盘，等写完再读
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep_lock(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+
+  if((mem = kalloc_user(0)) == 0)
+    return -1;
+  // 等待和分配时可能睡眠过，表项已被别人处理则放弃
+  if(*pte != old){
+    kfree(mem);
+    return 0;
+  }
+  virtio_swap_rw(mem, slot, 0);
+  *pte = PA2PTE(mem) | (old & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) | PTE_V;
+  swap_free(slot);
+  kstat_inc(KSTAT_SWAP_IN);
+  return 0;
+}
+
+// 用时钟算法回收最多 target 个用户页，返回实际换出的页数。
+// 可能睡眠，调用者不能持有自旋锁。
+int
+swap_reclaim(int target)
+{
+  struct proc *p;
+  uint64 va, pa, limit;
+  long slot;
+  pte_t *pte;
+  int freed = 0, passes = 0, r;
+
+  acquiresleep(&swap.rlock);
+  limit = swap.scan.scanned + SWAP_SCAN;
+  while(freed < target && swap.scan.scanned < limit){
+    acquire(&proc_lock);
+    if((p = uvm_scan_next(&swap.scan, &va, &pte)) == 0){
+      release(&proc_lock);
+      // 第一圈可能只清掉了 A 位，转两圈还不够就放弃
+      if(++passes == 2)
+        break;
+      continue;
+    }
+    r = -1;
+    if(kref_get((void*)PTE2PA(*pte)) != 1){
+      // 共享的页（COW、页缓存、合并页）不回收
+    } else if(*pte & (PTE_A|PTE_REF)){
+      *pte &= ~(PTE_A|PTE_REF);
+      uvm_flushproc(p);   // 让硬件重新记录访问
+    } else {
+      // 放不下的页（不可压缩且没有交换盘）留在内存中
+      r = swap_evict(p, pte, &pa, &slot);
+    }
+    release(&p->lock);
+    release(&proc_lock);
+
+    if(r == 1)
+      swap_write(pa, slot);
+    if(r >= 0)
+      freed++;
+  }
+  releasesleep(&swap.rlock);
+  return freed;
+}
+
+// 为用户页分配物理页，内存不足时同步回收。zero 为 0 时不清零。
+// 只能在进程上下文中调用，可能睡眠。
+void*
+kalloc_user(int zero)
+{
+  void *pa;
+
+  for(;;){
+    if((pa = zero ? kalloc() : kalloc_nozero()) != 0)
+      return pa;
+    if(pcache_reclaim(SWAP_BATCH) == 0 && swap_reclaim(SWAP_BATCH) == 0)
+      return 0;
+  }
+}
+
+// 空闲页不足时唤醒 kswapd。由 kalloc 调用，不会睡眠。调用者可能
+// 正持有 proc_lock（扫描者在临界区中分配内存），所以不遍历进程链表。
+void
+swap_kick(void)
+{
+  if(swap.kswapd)
+    wakeup_proc(swap.kswapd, &swap);
+}
+
+// 后台回收线程：把空闲页补到 SWAP_HIGH
+void
+kswapd(void)
+{
+  swap.kswapd = myproc();
+  for(;;){
+    while(kfreepages() < SWAP_HIGH &&
+          (pcache_reclaim(SWAP_BATCH) > 0 || swap_reclaim(SWAP_BATCH) > 0))
+      ;
+    sleep(&swap);
+  }
+}
@@ -1,8 +1,14 @@
 #include "../include/def.h"
+#include "../proc/proc.h"
+#include "../utils/spinlock.h"
 
 pagetable_t kernel_pagetable;
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
+// 内核 RAM 映射所在的顶级页表项 [KERNBASE, kshared_end) 也装入每个
+// 用户页表（uvmkshare），见下面的 copyin/copyout 快速路径。
+static uint64 kshared_end;
+
 extern char trampoline[];  // 声明trampoline
 
 pagetable_t
@@ -21,27 +27,36 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // virtio mmio swap disk interface
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
 
+  // KERNBASE 以上的映射和 trampoline 标为全局（PTE_G），切换 ASID
+  // 时不需要作废。用户地址空间不会使用 KERNBASE 以上的这段地址
+  // （见 growproc），低端的 MMIO 映射则可能与用户页重叠，不能标为全局。
+
   // map kernel text executable and read-only.
-  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // map trampoline to the highest address in both user and kernel space
   // 将trampoline映射到最高地址，用于用户态和内核态之间的切换
-  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
   
   return kpgtbl;
 }
 
+// 内核映射尽可能使用大页（2MiB / 1GiB 叶子PTE），
+// 只有对齐不满足的边角部分才退回 4KiB 页。
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mapregion(kpgtbl, va, sz, pa, perm, 2) != 0)
     panic("kvmmap");
 }
 
@@ -49,6 +64,9 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  kshared_end = (PHYSTOP + LEVELSIZE(2) - 1) & ~(LEVELSIZE(2) - 1);
+  if(kshared_end > MMAPBASE)
+    panic("kvminit: RAM overlaps mmap region");
 }
 
 // Switch the current CPU's h/w page table register to
@@ -65,6 +83,99 @@ kvminithart()
   sfence_vma();
 }
 
+// ============================================================================
+// ASID 分配
+// 内核页表固定使用 ASID 0，用户进程从 1 开始分配。p->asid 的低
+// 16 位是 ASID，高位是分配时的代数（generation）；代数不等于当前
+// asid_generation 的 ASID 视为已作废。ASID 用完时代数加一并刷新
+// 整个 TLB，此后所有进程在下次返回用户态时重新分配。
+// 作废一个进程的地址空间（uvm_flush）只需把它的 ASID 置为无效，
+// 新分配的 ASID 在本代中从未使用过，TLB 中不可能有它的旧表项。
+// 硬件不支持 ASID 时所有进程都用 ASID 0，由 trampoline 在每次
+// 切换页表时刷新整个 TLB。
+// ============================================================================
+
+#define ASID_GEN_INC (SATP_ASID_MASK + 1)
+
+static struct spinlock asid_lock;
+static uint64 asid_generation = ASID_GEN_INC;
+static uint64 asid_next = 1;
+static uint64 asid_max;                // 0 表示硬件不支持 ASID
+static int asid_flush_pending[NCPU];   // 回绕后各CPU需要刷新一次 TLB
+
+// 探测硬件实现的 ASID 位数：向 satp 的 ASID 字段写全 1 再读回
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asid_lock, "asid");
+  w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+  asid_max = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(satp);
+  sfence_vma();
+  printf("asidinit: %d ASIDs available\n", (int)asid_max);
+}
+
+// 返回进程 p 返回用户态时应写入 satp 的值，必要时为它分配新的 ASID
+uint64
+uvm_satp(struct proc *p)
+{
+  uint64 asid;
+
+  if(asid_max == 0)
+    return MAKE_SATP(p->pagetable);
+
+  acquire(&asid_lock);
+  if((p->asid & ~SATP_ASID_MASK) != asid_generation){
+    if(asid_next > asid_max){
+      // 本代 ASID 已用完：进入新的一代，所有CPU都要刷新一次
+      asid_generation += ASID_GEN_INC;
+      asid_next = 1;
+      for(int i = 0; i < NCPU; i++)
+        asid_flush_pending[i] = 1;
+      kstat_inc(KSTAT_ASID_ROLLOVER);
+    }
+    p->asid = asid_generation | asid_next++;
+  }
+  if(asid_flush_pending[cpuid()]){
+    asid_flush_pending[cpuid()] = 0;
+    sfence_vma();
+    kstat_inc(KSTAT_TLB_FLUSH);
+  }
+  asid = p->asid & SATP_ASID_MASK;
+  release(&asid_lock);
+
+  return MAKE_SATP_ASID(p->pagetable, asid);
+}
+
+// 页表 pagetable 中的映射被撤销或降级后调用，作废 TLB 中的旧表项。
+// 只有当前进程的页表可能被加载过；其他页表（exec 中新建的、fork
+// 出来还未运行的子进程的）在 TLB 中没有表项。
+void
+uvm_flush(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  uvm_flushproc(p);
+}
+
+// 作废进程 p（不一定是当前进程）在 TLB 中的所有用户表项。
+// 换出其他进程的页时使用：p 在下次返回用户态时会拿到新的 ASID。
+void
+uvm_flushproc(struct proc *p)
+{
+  if(asid_max == 0){
+    sfence_vma();
+    kstat_inc(KSTAT_TLB_FLUSH);
+    return;
+  }
+  p->asid = 0;
+  kstat_inc(KSTAT_ASID_FLUSH);
+}
+
 pagetable_t
 create_pagetable()
 {
@@ -76,11 +187,15 @@ create_pagetable()
   return pagetable;
 }
 
+// 建立 [va, va+size) 到 pa 的映射。只要 va、pa 对齐且剩余长度足够，
+// 就在不超过 maxlevel 的最高一级直接放叶子PTE（Sv39 的 2MiB/1GiB 大页），
+// 否则用 4KiB 页。
 int
-mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+mapregion(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int maxlevel)
 {
-  uint64 a, last;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -92,30 +207,47 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+  end = va + size;
+  while(a < end){
+    for(level = maxlevel; level > 0; level--){
+      if((a % LEVELSIZE(level)) == 0 && (pa % LEVELSIZE(level)) == 0 &&
+         a + LEVELSIZE(level) <= end)
+        break;
+    }
+    if((pte = walklevel(pagetable, a, level, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
   }
   return 0;
 }
 
+// 只使用 4KiB 页的映射，用户页表都走这里。用户页不能映射到
+// 共享的内核项中（见 uvm_kshared）。
+int
+mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  if((perm & PTE_U) && uvm_kshared(va, va + size))
+    return -1;
+  return mapregion(pagetable, va, size, pa, perm, 0);
+}
+
+// 返回 va 在第 level 级页表中对应的PTE，alloc 非零时分配缺失的
+// 中间页表。途中遇到更高一级的叶子PTE（大页）时直接返回它。
 pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -124,7 +256,13 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
+}
+
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
 }
 
 // Look up a virtual address, return the physical address,
@@ -187,8 +325,13 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
       continue;   
-    if((*pte & PTE_V) == 0)  // has physical page been allocated?
+    if((*pte & PTE_V) == 0){  // has physical page been allocated?
+      // 已换出的页只占着交换盘上的 slot
+      if((*pte & PTE_SWAP) && do_free)
+        swap_free(PTE2SWAP(*pte));
+      *pte = 0;
       continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
@@ -196,6 +339,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  uvm_flush(pagetable);
 }
 
 void
@@ -207,37 +351,250 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 }
 
 
-// 复制父进程页表到子进程
+// 复制父进程页表到子进程（写时复制）
+// 不复制物理页，而是让子进程共享父进程的页：可写页在父子两边
+// 都改为只读并打上 PTE_COW，写入时由 cowfault() 再复制。
+// 开销只与页表大小成正比。
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  return uvmshare(old, new, 0, PGROUNDUP(sz), 0);
+}
+
+// 让 new 在 [start, end) 中映射与 old 相同的物理页。shared 为 0 时
+// 可写页按写时复制处理，否则两边都保持可写（MAP_SHARED）。
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int shared)
+{
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = start; i < end; i += PGSIZE){
+    // 惰性分配的页可能还没有映射
+    if((pte = walk(old, i, 0)) == 0 || (*pte & (PTE_V|PTE_SWAP)) == 0)
+      continue;
+    // 已换出的页：两边共用交换盘上的 slot，各自换入时得到私有副本
+    if((*pte & PTE_V) == 0){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swap_dup(PTE2SWAP(*pte));
+      *npte = *pte;
+      continue;
+    }
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kref_inc((void*)pa);
   }
+  // 父进程的可写映射已改为只读，旧的 TLB 项必须作废
+  if(!shared)
+    uvm_flush(old);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
+  if(!shared)
+    uvm_flush(old);
   return -1;
 }
 
+// 处理对 COW 页 va 的写入：如果只剩这一个引用就直接恢复可写，
+// 否则复制一份私有页。成功返回 0，va 不是 COW 页或内存不足返回 -1。
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(kref_get((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+  } else {
+    // 分配时可能同步回收而睡眠，先多拿一个引用，免得共享者退出后
+    // 这一页被换出
+    old = *pte;
+    kref_inc((void*)pa);
+    if((mem = kalloc_user(0)) == 0){
+      kfree((void*)pa);
+      return -1;
+    }
+    if(*pte != old){
+      kfree(mem);
+      kfree((void*)pa);
+      return 0;
+    }
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    kfree((void*)pa);   // 上面多拿的引用
+    kfree((void*)pa);   // 这个映射的引用
+  }
+  uvm_flush(pagetable);
+  return 0;
+}
+
+// 用户页错误的统一入口。va 低于 p->sz 但尚未映射的页：落在
+// 文件 VMA 中的从文件读入（vma_fault），否则是惰性分配的匿名页，
+// 在这里分配一个清零页；对 COW 页的写入交给 cowfault()。
+// access 是 FAULT_READ、FAULT_WRITE 或 FAULT_EXEC，表项或 VMA 的
+// 权限不允许这种访问时（例如跳到不可执行的页）返回 -1。
+// 成功返回 0，非法访问或内存不足返回 -1。
+int
+vmfault(struct proc *p, uint64 va, int access)
+{
+  pte_t *pte;
+  char *mem;
+  struct vma *v;
+  int need = access == FAULT_WRITE ? PTE_W : access == FAULT_EXEC ? PTE_X : PTE_R;
+
+  if(va >= MAXVA)
+    return -1;
+  // sz 以下是堆和 ELF 段，sz 之上只有 mmap 区域和栈
+  if((v = vma_find(p->vma, va)) == 0 && va >= p->sz &&
+     (v = vma_growstack(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(p->pagetable, va, 0);
+  // 换出的页先读回来，再按普通的有效表项处理
+  if(pte && (*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP){
+    p->mstat.majflt++;
+    if(swap_in(p->pagetable, va, pte) < 0)
+      return -1;
+    pte = walk(p->pagetable, va, 0);
+  } else {
+    p->mstat.minflt++;
+  }
+  if(pte && (*pte & PTE_V)){
+    if(access == FAULT_WRITE && (*pte & PTE_COW))
+      return cowfault(p->pagetable, va);
+    // 表项已经允许这次访问：TLB 中残留的旧表项引起的虚假缺页
+    if((*pte & PTE_U) && (*pte & need)){
+      uvm_flush(p->pagetable);
+      return 0;
+    }
+    return -1;
+  }
+
+  if(v){
+    if(access != FAULT_READ && (v->perm & need) == 0)
+      return -1;
+    return vma_fault(p, v, va);
+  }
+
+  // 堆中的匿名页不可执行
+  if(access == FAULT_EXEC)
+    return -1;
+  if((mem = kalloc_user(1)) == 0)
+    return -1;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// 找出 p 中不小于 va 的第一段用户区域 [*start, *end)：堆和 ELF 段
+// [0, sz) 以及 mmap 区域（包括栈）。private 不为 0 时跳过共享映射
+// （MAP_SHARED），它们的页不参与回收和合并。返回区域的标志
+// （[0, sz) 为 MAP_PRIVATE），没有则返回 0。
+int
+uvm_range(struct proc *p, uint64 va, uint64 *start, uint64 *end, int private)
+{
+  struct vma *v, *best = 0;
+
+  if(va < p->sz){
+    *start = va;
+    *end = p->sz;
+    return MAP_PRIVATE;
+  }
+  for(v = p->vma; v; v = v->next){
+    if(!(v->flags & VMA_MMAP) || (private && (v->flags & MAP_SHARED)) || v->end <= va)
+      continue;
+    if(best == 0 || v->start < best->start)
+      best = v;
+  }
+  if(best == 0)
+    return 0;
+  *start = va > best->start ? va : best->start;
+  *end = best->end;
+  return best->flags;
+}
+
+// 把游标 s 移到下一个已映射的用户私有页，返回所在进程，地址和
+// 叶子表项分别存入 *va 和 *pte。走完所有进程（一圈）时返回 0，
+// 游标回到开头。缺失的下级页表整段跳过。
+// 调用者必须持有 proc_lock。返回的进程已加上 p->lock（见
+// proc_next_user），由调用者释放，进程和表项只在释放之前有效。
+struct proc*
+uvm_scan_next(struct uvm_scan *s, uint64 *va, pte_t **pte)
+{
+  struct proc *p;
+  uint64 a, end;
+  pte_t *pde;
+
+  for(;;){
+    if((p = proc_next_user(s->pid)) == 0){
+      s->pid = 0;
+      s->va = 0;
+      return 0;
+    }
+    if(p->pid != s->pid){
+      s->pid = p->pid;
+      s->va = 0;
+    }
+    if(!uvm_range(p, s->va, &a, &end, 1)){
+      s->pid = p->pid + 1;
+      s->va = 0;
+      release(&p->lock);
+      continue;
+    }
+
+    pde = walklevel(p->pagetable, a, 1, 0);
+    if(pde == 0 || (*pde & PTE_V) == 0){
+      s->va = (a + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+      if(s->va > end)
+        s->va = end;
+      release(&p->lock);
+      continue;
+    }
+    *pte = walk(p->pagetable, a, 0);
+    s->va = a + PGSIZE;
+    s->scanned++;
+    if(*pte && (**pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+      *va = a;
+      return p;
+    }
+    release(&p->lock);
+  }
+}
+
+// copyin/copyout 访问尚未映射的用户页时按需调入。
+// 只对当前进程自己的页表有效。
+static int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return -1;
+  return vmfault(p, va, write ? FAULT_WRITE : FAULT_READ);
+}
+
 // 分配用户内存（增长进程内存）
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
@@ -255,7 +612,6 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -283,20 +639,127 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // ============================================================================
 // 用户空间辅助函数
 // 用于在用户空间和内核空间之间复制数据
+//
+// 快速路径：用户页表中装有内核 RAM 的顶级页表项（uvmkshare），
+// 所以可以关中断、临时切换到当前进程的页表并打开 sstatus.SUM，
+// 由 uaccess.S 直接按用户虚拟地址复制，省去逐页的软件查表。
+// 缺页（懒分配、COW、非法地址）由异常表修复为返回 -1，然后整段
+// 退回到下面逐页 walk 的慢速路径，由它调入页面或报告错误。
+// 需要 ASID：切换页表不刷新 TLB，没有 ASID 时只走慢速路径。
 // ============================================================================
 
+struct exentry {
+  uint64 insn;    // 可能出错的访问指令
+  uint64 fixup;   // 出错后继续执行的地址
+};
+extern struct exentry __ex_table_start[], __ex_table_end[];
+
+// uaccess.S
+int uaccess_copy(void *dst, const void *src, uint64 n);
+long uaccess_strncpy(char *dst, const char *src, uint64 max);
+
+// 把内核 RAM 的顶级页表项装入用户页表。这些项指向内核自己的
+// 下级页表，叶子带 PTE_G 且没有 PTE_U，用户态无法访问。
+void
+uvmkshare(pagetable_t pagetable)
+{
+  for(uint64 va = KERNBASE; va < kshared_end; va += LEVELSIZE(2))
+    pagetable[PX(2, va)] = kernel_pagetable[PX(2, va)];
+}
+
+// 释放用户页表之前撤掉共享的内核项，避免 free_pagetable 释放内核页表
+void
+uvmkunshare(pagetable_t pagetable)
+{
+  for(uint64 va = KERNBASE; va < kshared_end; va += LEVELSIZE(2))
+    pagetable[PX(2, va)] = 0;
+}
+
+// 用户地址范围 [start, end) 是否落入共享的内核项。在这里建立用户
+// 映射会往内核自己的下级页表里加表项，所有进程和内核都能看到。
+int
+uvm_kshared(uint64 start, uint64 end)
+{
+  return end > KERNBASE && start < kshared_end;
+}
+
+// 内核访问用户内存时出错的指令 epc 的修复地址，不是这类指令返回 0
+uint64
+uaccess_fixup(uint64 epc)
+{
+  struct exentry *e;
+
+  for(e = __ex_table_start; e < __ex_table_end; e++)
+    if(e->insn == epc)
+      return e->fixup;
+  return 0;
+}
+
+// 尝试为访问用户地址 [va, va+len) 进入快速路径，成功返回 1，
+// 之后必须调用 uaccess_end()。内核映射和 TRAPFRAME 没有 PTE_U，
+// 但 S 模式照样能访问，所以用户指针必须先排除这些地址。
+static int
+uaccess_begin(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 end = va + len;
+
+  if(asid_max == 0 || p == 0 || p->pagetable != pagetable)
+    return 0;
+  if(end < va || end > TRAPFRAME || uvm_kshared(va, end))
+    return 0;
+
+  push_off();
+  w_satp(uvm_satp(p));
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  return 1;
+}
+
+static void
+uaccess_end(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  w_satp(MAKE_SATP(kernel_pagetable));
+  pop_off();
+}
+
 // 从内核复制数据到用户空间
 // 返回复制的字节数，失败返回 -1
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int r;
+
+  if(uaccess_begin(pagetable, dstva, len)){
+    r = uaccess_copy((void *)dstva, src, len);
+    uaccess_end();
+    if(r == 0)
+      return 0;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0){
+      if(uvmfault(pagetable, va0, 1) < 0)
+        return -1;
+      pte = walk(pagetable, va0, 0);
+    }
+    if((*pte & PTE_U) == 0)
+      return -1;
+    // 写 COW 页前先复制，避免改到共享的物理页
+    if((*pte & PTE_COW) && cowfault(pagetable, va0) < 0)
       return -1;
+    if((*pte & PTE_W) == 0)
+      return -1;
+    // 通过直接映射写入时硬件不会设置 D 位，手动标记，
+    // 共享文件映射才会在解除映射时写回
+    *pte |= PTE_A | PTE_D;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -315,12 +778,23 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r;
+
+  if(uaccess_begin(pagetable, srcva, len)){
+    r = uaccess_copy(dst, (const void *)srcva, len);
+    uaccess_end();
+    if(r == 0)
+      return 0;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(uvmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -340,12 +814,25 @@ copyin_str(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  long r;
+
+  if(uaccess_begin(pagetable, srcva, max)){
+    r = uaccess_strncpy(dst, (const char *)srcva, max);
+    uaccess_end();
+    if(r >= 0)
+      return 0;
+    if(r == -2)
+      return -1;
+  }
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(uvmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -383,4 +870,5 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvm_flush(pagetable);
 }
@@ -0,0 +1,363 @@
+// Per-process virtual memory areas.
+//
+// 每个进程有一个按起始地址排序的 VMA 链表，记录用户地址空间中
+// 按需调入的区域：exec 装入的 ELF 段，以及 mmap() 建立的文件映射
+// 和匿名映射。这些区域建立时不分配物理页，第一次访问缺页时由
+// vma_fault() 填入；超出 filesz 或文件末尾的部分为零。文件页来自
+// 页缓存（pagecache.c）：只读映射和共享映射直接映射缓存页，私有
+// 可写映射以写时复制方式映射，第一次写入时才复制。不在任何 VMA
+// 中、但低于 p->sz 的页是匿名页，由 vmfault() 直接分配清零页。
+//
+// mmap 区域（VMA_MMAP）位于 MMAPBASE..MMAPTOP，在 sz 之上，不被
+// uvmcopy()/uvmfree() 覆盖，由 fork() 用 uvmshare() 复制，由
+// vma_unmap()/vma_release() 解除映射。共享文件映射中被写过的页
+// （PTE_D）在解除映射时写回文件，不会扩展文件。
+//
+// 用户栈也是这样一个私有匿名区域（VMA_MMAP|VMA_STACK），位于
+// USTACKTOP 之下。访问栈 VMA 之下、p->stackmax 之内的地址时由
+// vma_growstack() 把它向下扩展，再按普通的匿名页处理。
+//
+// VMA 持有 inode 的一个引用，vma_free() 会 iput，必须在文件系统
+// 事务（begin_op/end_op）中调用。
+
+#include "../include/def.h"
+#include "../proc/proc.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../utils/sleeplock.h"
+
+static struct kmem_cache *vma_cache;
+
+void
+vmainit(void)
+{
+  vma_cache = kmem_cache_create("vma", sizeof(struct vma), 0);
+  if(vma_cache == 0)
+    panic("vmainit");
+}
+
+// 在链表 *list 中按地址顺序插入 [start, end) 区域，
+// 区域与已有 VMA 重叠时返回 -1。成功时取得 ip 的一个新引用。
+int
+vma_add(struct vma **list, uint64 start, uint64 end, int perm, int flags,
+        struct inode *ip, uint64 off, uint64 filesz)
+{
+  struct vma *v, **pp;
+
+  if(start % PGSIZE != 0 || start >= end)
+    return -1;
+  end = PGROUNDUP(end);
+  if(uvm_kshared(start, end))
+    return -1;
+  for(pp = list; *pp && (*pp)->start < end; pp = &(*pp)->next)
+    if((*pp)->end > start)
+      return -1;
+
+  if((v = kmem_cache_alloc(vma_cache)) == 0)
+    return -1;
+  v->start = start;
+  v->end = end;
+  v->perm = perm;
+  v->flags = flags;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  v->filesz = filesz;
+  v->next = *pp;
+  *pp = v;
+  return 0;
+}
+
+// 查找包含 va 的 VMA
+struct vma*
+vma_find(struct vma *list, uint64 va)
+{
+  struct vma *v;
+
+  for(v = list; v && v->start <= va; v = v->next)
+    if(va < v->end)
+      return v;
+  return 0;
+}
+
+// 释放整个链表。调用者必须处于文件系统事务中。
+void
+vma_free(struct vma **list)
+{
+  struct vma *v;
+
+  while((v = *list) != 0){
+    *list = v->next;
+    if(v->ip)
+      iput(v->ip);
+    kmem_cache_free(vma_cache, v);
+  }
+}
+
+// fork 时复制 VMA 链表，失败返回 -1 且不留下部分结果
+int
+vma_dup(struct vma **dst, struct vma *src)
+{
+  struct vma *v, **tail = dst;
+
+  *dst = 0;
+  for(v = src; v; v = v->next){
+    if(vma_add(tail, v->start, v->end, v->perm, v->flags, v->ip, v->off, v->filesz) < 0){
+      begin_op();
+      vma_free(dst);
+      end_op();
+      return -1;
+    }
+    tail = &(*tail)->next;
+  }
+  return 0;
+}
+
+// VMA v 中偏移 off 处的页有多少字节来自文件：不超过 filesz，
+// 也不超过文件当前的大小
+static uint64
+vma_filebytes(struct vma *v, uint64 off)
+{
+  uint64 n, foff, size;
+
+  if(v->ip == 0 || off >= v->filesz)
+    return 0;
+  n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+  foff = v->off + off;
+  ilock(v->ip);
+  size = v->ip->size;
+  iunlock(v->ip);
+  if(foff >= size)
+    return 0;
+  return foff + n > size ? size - foff : n;
+}
+
+// 为 VMA v 中的页 va 建立映射，映射到 p 的页表。
+// 成功返回 0，内存不足或读文件失败返回 -1。
+int
+vma_fault(struct proc *p, struct vma *v, uint64 va)
+{
+  uint64 n, foff;
+  int perm = v->perm | PTE_R | PTE_U;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  n = vma_filebytes(v, va - v->start);
+  foff = v->off + (va - v->start);
+
+  if(n > 0 && foff % PGSIZE == 0 && (n == PGSIZE || (v->flags & MAP_SHARED))){
+    // 文件页零拷贝地映射页缓存中的页；私有可写映射先映射为
+    // 只读的 COW 页，第一次写入时由 cowfault() 复制
+    if((mem = pcache_get(v->ip, foff)) == 0)
+      return -1;
+    if((perm & PTE_W) && (v->flags & MAP_SHARED) == 0)
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    // 匿名页，或私有映射中只有前 n 字节来自文件的页（段尾接着
+    // bss，其余必须为零）和没有按页对齐的文件页：用私有的页
+    if((mem = kalloc_user(1)) == 0)
+      return -1;
+    if(n > 0){
+      ilock(v->ip);
+      if(readi(v->ip, 0, (uint64)mem, foff, n) != n){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+      iunlock(v->ip);
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// 把共享文件映射中 va 处被写过的页 pa 写回文件
+static void
+vma_writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  uint64 n;
+
+  if((n = vma_filebytes(v, va - v->start)) == 0)
+    return;
+  // 每页一个事务，避免超出日志大小
+  begin_op();
+  ilock(v->ip);
+  writei(v->ip, 0, pa, v->off + (va - v->start), n);
+  iunlock(v->ip);
+  end_op();
+}
+
+// 解除 VMA v 中 [start, end) 的映射并释放物理页，
+// 共享文件映射中的脏页先写回文件
+void
+vma_unmap(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if((v->flags & MAP_SHARED) && v->ip){
+    for(a = start; a < end; a += PGSIZE){
+      if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(*pte & PTE_D)
+        vma_writeback(v, a, PTE2PA(*pte));
+    }
+  }
+  uvmunmap(pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// 进程退出或 exec 时释放整个 VMA 链表：解除 mmap 区域的映射
+// （sz 以下的区域由 uvmfree 释放），再释放 VMA 本身。
+// 调用者不能处于文件系统事务中。
+void
+vma_release(pagetable_t pagetable, struct vma **list)
+{
+  struct vma *v;
+
+  for(v = *list; v; v = v->next)
+    if(v->flags & VMA_MMAP)
+      vma_unmap(pagetable, v, v->start, v->end);
+  begin_op();
+  vma_free(list);
+  end_op();
+}
+
+// 栈的自动增长：va 在栈 VMA 之下、p->stackmax 的范围之内时，把栈
+// VMA 的起点下移到 va 所在的页，返回栈 VMA；之后由 vma_fault()
+// 像匿名 mmap 一样按需分配清零页。否则返回 0。
+struct vma*
+vma_growstack(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  // 链表按 start 排序，第一个是最低的一段（munmap 可能把栈拆开）
+  for(v = p->vma; v; v = v->next)
+    if(v->flags & VMA_STACK)
+      break;
+  if(v == 0 || va >= v->start || va < USTACKTOP - p->stackmax)
+    return 0;
+  v->start = PGROUNDDOWN(va);
+  return v;
+}
+
+// 在 p 的地址空间中建立 len 字节的映射，ip 为 0 时是匿名映射。
+// 地址在 MMAPBASE..MMAPTOP 中自顶向下选择。
+// 返回映射的起始地址，失败返回 MAP_FAILED。
+uint64
+vma_mmap(struct proc *p, uint64 len, int perm, int flags, struct inode *ip, uint64 off)
+{
+  uint64 addr, a;
+  struct vma *v;
+
+  if(len == 0 || len > MMAPTOP - MMAPBASE || off % PGSIZE != 0)
+    return MAP_FAILED;
+  len = PGROUNDUP(len);
+
+  // 从 MMAPTOP 往下找第一个放得下的空隙
+  addr = MMAPTOP - len;
+  for(v = p->vma; v; ){
+    if(v->start < addr + len && addr < v->end){
+      if(v->start < MMAPBASE + len)
+        return MAP_FAILED;
+      addr = v->start - len;
+      v = p->vma;
+      continue;
+    }
+    v = v->next;
+  }
+
+  if(vma_add(&p->vma, addr, addr + len, perm, flags | VMA_MMAP, ip, off, ip ? len : 0) < 0)
+    return MAP_FAILED;
+
+  // 共享匿名页没有文件可以重新读入，立即分配，
+  // 这样 fork 之后父子进程看到的是同一组物理页
+  if(ip == 0 && (flags & MAP_SHARED)){
+    v = vma_find(p->vma, addr);
+    for(a = addr; a < addr + len; a += PGSIZE){
+      if(vma_fault(p, v, a) < 0){
+        vma_munmap(p, addr, len);
+        return MAP_FAILED;
+      }
+    }
+  }
+  return addr;
+}
+
+// 把 v 的起点推到 start，文件偏移随之前移
+static void
+vma_trim(struct vma *v, uint64 start)
+{
+  uint64 delta = start - v->start;
+
+  v->start = start;
+  v->off += delta;
+  v->filesz = v->filesz > delta ? v->filesz - delta : 0;
+}
+
+// 解除 [addr, addr+len) 中所有 mmap 区域的映射，
+// 部分覆盖的 VMA 被截短或一分为二。成功返回 0。
+int
+vma_munmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *nv = 0, **pp;
+  uint64 end, a, b;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if(end < addr || end > MAXVA)
+    return -1;
+
+  // 只有一个 VMA 严格包含整个范围时才需要一分为二。先分配好新节点，
+  // 分配失败时还什么都没有解除映射
+  for(v = p->vma; v; v = v->next){
+    if((v->flags & VMA_MMAP) && v->start < addr && end < v->end){
+      if((nv = kmem_cache_alloc(vma_cache)) == 0)
+        return -1;
+      break;
+    }
+  }
+
+  for(pp = &p->vma; (v = *pp) != 0; ){
+    if((v->flags & VMA_MMAP) == 0 || v->end <= addr || v->start >= end){
+      pp = &v->next;
+      continue;
+    }
+    a = v->start > addr ? v->start : addr;
+    b = v->end < end ? v->end : end;
+
+    if(a > v->start && b < v->end){
+      // 从中间挖掉一段：后半部分成为新的 VMA（nv 已在上面分配）
+      vma_unmap(p->pagetable, v, a, b);
+      *nv = *v;
+      if(nv->ip)
+        idup(nv->ip);
+      vma_trim(nv, b);
+      v->end = a;
+      v->next = nv;
+      pp = &nv->next;
+      continue;
+    }
+
+    vma_unmap(p->pagetable, v, a, b);
+    if(a == v->start && b == v->end){
+      *pp = v->next;
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      kmem_cache_free(vma_cache, v);
+      continue;
+    }
+    if(a == v->start)
+      vma_trim(v, b);
+    else
+      v->end = a;
+    pp = &v->next;
+  }
+  return 0;
+}
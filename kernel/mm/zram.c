@@ -0,0 +1,303 @@
+// Compressed in-RAM store for swapped-out anonymous pages.
+//
+// 回收时页面先尝试压缩到这里，压缩后的数据放在按 ZRAM_CLASS 字节
+// 分级的 slab 缓存中，只有放不下（不可压缩或超过 ZRAM_LIMIT）时才
+// 写到交换盘。由 swap.c 使用：交换表项中的 slot 带 SWAP_ZRAM 位时，
+// 低位是这里的条目下标。
+//
+// 压缩算法是 LZ4 块格式的一个简化实现：每个序列以一个 token 字节
+// 开头，高 4 位是字面量长度、低 4 位是匹配长度减 LZ_MINMATCH，为 15
+// 时后面跟若干扩展字节（255 表示继续）；然后是字面量、2 字节的小端
+// 偏移和扩展的匹配长度。最后一个序列只有字面量。整页都是同一个
+// 64 位值（多数是全 0 页）时不压缩，只记下这个值。
+
+#include "../include/def.h"
+#include "../utils/spinlock.h"
+
+#define LZ_MINMATCH   4
+#define LZ_LASTLITS   5     // 最后这些字节总是作为字面量输出
+#define LZ_HASHLOG    12
+
+struct zpage {
+  char *data;     // 压缩数据，0 表示同值页
+  ushort len;     // 压缩后的长度
+  uchar ref;      // 引用此条目的交换表项数，0 为空闲
+  uint64 fill;    // 同值页的值
+};
+
+static struct {
+  struct spinlock lock;   // 保护下面所有字段，压缩时也持有（共用 hash 和 buf）
+  struct zpage *tab;
+  uint64 hint;
+  uint64 bytes;           // 压缩数据占用的字节数（按分级大小计）
+  struct kmem_cache *cache[ZRAM_MAXLEN / ZRAM_CLASS];
+  ushort hash[1 << LZ_HASHLOG];
+  uchar buf[ZRAM_MAXLEN];
+} zram;
+
+static char *class_names[ZRAM_MAXLEN / ZRAM_CLASS] = {
+  "zram256", "zram512", "zram768", "zram1024", "zram1280", "zram1536",
+  "zram1792", "zram2048", "zram2304", "zram2560", "zram2816", "zram3072",
+};
+
+void
+zraminit(void)
+{
+  uint64 bytes = ZRAM_PAGES * sizeof(struct zpage);
+  int order, i;
+
+  initlock(&zram.lock, "zram");
+  for(order = 0; ((uint64)PGSIZE << order) < bytes; order++)
+    ;
+  if((zram.tab = kalloc_pages(order)) == 0)
+    panic("zraminit");
+  for(i = 0; i < ZRAM_MAXLEN / ZRAM_CLASS; i++)
+    if((zram.cache[i] = kmem_cache_create(class_names[i], (i + 1) * ZRAM_CLASS, 0)) == 0)
+      panic("zraminit: cache");
+}
+
+static uint32
+lz_read32(const uchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// 输出扩展长度字节
+static uchar*
+lz_putlen(uchar *op, uint n)
+{
+  for(; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+// 压缩一页到 dst，输出不超过 dstmax 字节。返回压缩后的长度，放不下返回 -1。
+// 调用者持有 zram.lock。
+static int
+lz_compress(const uchar *src, uchar *dst, int dstmax)
+{
+  const uchar *ip = src, *anchor = src, *ref, *m;
+  const uchar *end = src + PGSIZE, *mlimit = end - LZ_LASTLITS;
+  uchar *op = dst, *oend = dst + dstmax, *token;
+  uint32 seq, h;
+  uint lit, mlen, off;
+
+  memset(zram.hash, 0, sizeof(zram.hash));
+  while(ip + LZ_MINMATCH <= mlimit){
+    seq = lz_read32(ip);
+    h = (seq * 2654435761U) >> (32 - LZ_HASHLOG);
+    ref = src + zram.hash[h];
+    zram.hash[h] = ip - src;
+    if(ref >= ip || lz_read32(ref) != seq){
+      ip++;
+      continue;
+    }
+
+    m = ip + LZ_MINMATCH;
+    while(m < mlimit && *m == ref[m - ip])
+      m++;
+    lit = ip - anchor;
+    mlen = m - ip - LZ_MINMATCH;
+    off = ip - ref;
+    if(oend - op < 1 + lit + lit/255 + 1 + 2 + mlen/255 + 1)
+      return -1;
+
+    token = op++;
+    *token = ((lit >= 15 ? 15 : lit) << 4) | (mlen >= 15 ? 15 : mlen);
+    if(lit >= 15)
+      op = lz_putlen(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    *op++ = off;
+    *op++ = off >> 8;
+    if(mlen >= 15)
+      op = lz_putlen(op, mlen - 15);
+    ip = anchor = m;
+  }
+
+  lit = end - anchor;
+  if(oend - op < 1 + lit + lit/255 + 1)
+    return -1;
+  token = op++;
+  *token = (lit >= 15 ? 15 : lit) << 4;
+  if(lit >= 15)
+    op = lz_putlen(op, lit - 15);
+  memcpy(op, anchor, lit);
+  op += lit;
+  return op - dst;
+}
+
+// 解压 src 中 len 字节到一页 dst。数据损坏返回 -1。
+static int
+lz_decompress(const uchar *src, int len, uchar *dst)
+{
+  const uchar *ip = src, *iend = src + len, *ref;
+  uchar *op = dst, *oend = dst + PGSIZE;
+  uint token, lit, mlen, off, b;
+
+  while(ip < iend){
+    token = *ip++;
+    lit = token >> 4;
+    if(lit == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        lit += (b = *ip++);
+      } while(b == 255);
+    }
+    if(lit > iend - ip || lit > oend - op)
+      return -1;
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if(ip == iend)
+      break;
+
+    if(iend - ip < 2)
+      return -1;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if(off == 0 || off > op - dst)
+      return -1;
+    mlen = token & 15;
+    if(mlen == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        mlen += (b = *ip++);
+      } while(b == 255);
+    }
+    mlen += LZ_MINMATCH;
+    if(mlen > oend - op)
+      return -1;
+    // 源和目的可能重叠（off < mlen），只能逐字节复制
+    for(ref = op - off; mlen > 0; mlen--)
+      *op++ = *ref++;
+  }
+  return op == oend ? 0 : -1;
+}
+
+// 整页是否都是同一个 64 位值
+static int
+page_same_filled(const uint64 *p, uint64 *fill)
+{
+  for(int i = 1; i < PGSIZE / sizeof(uint64); i++)
+    if(p[i] != p[0])
+      return 0;
+  *fill = p[0];
+  return 1;
+}
+
+// 在表中找一个空闲条目。调用者持有 zram.lock。
+static long
+zram_slot(void)
+{
+  uint64 i, s;
+
+  for(i = 0; i < ZRAM_PAGES; i++){
+    s = (zram.hint + i) % ZRAM_PAGES;
+    if(zram.tab[s].ref == 0){
+      zram.hint = s + 1;
+      return s;
+    }
+  }
+  return -1;
+}
+
+// 把物理页 pa 的内容压缩存入，返回条目下标（引用数为 1）。
+// 页面不可压缩、表满或压缩内存超过 ZRAM_LIMIT 时返回 -1。
+long
+zram_store(void *pa)
+{
+  struct zpage *z;
+  long idx;
+  int len, c;
+  char *data;
+
+  acquire(&zram.lock);
+  if((idx = zram_slot()) < 0)
+    goto fail;
+  z = &zram.tab[idx];
+  if(page_same_filled(pa, &z->fill)){
+    z->data = 0;
+    z->len = 0;
+  } else {
+    if((len = lz_compress(pa, zram.buf, ZRAM_MAXLEN)) < 0)
+      goto fail;
+    c = (len - 1) / ZRAM_CLASS;
+    if(zram.bytes + (c + 1) * ZRAM_CLASS > (uint64)ZRAM_LIMIT * PGSIZE)
+      goto fail;
+    if((data = kmem_cache_alloc(zram.cache[c])) == 0)
+      goto fail;
+    memcpy(data, zram.buf, len);
+    z->data = data;
+    z->len = len;
+    zram.bytes += (c + 1) * ZRAM_CLASS;
+  }
+  z->ref = 1;
+  kstat_inc(KSTAT_ZRAM_STORE);
+  kstat_add(KSTAT_ZRAM_ORIG, PGSIZE);
+  kstat_set(KSTAT_ZRAM_COMPR, zram.bytes);
+  release(&zram.lock);
+  return idx;
+
+ fail:
+  release(&zram.lock);
+  return -1;
+}
+
+// 把条目 idx 解压到物理页 pa，不释放条目
+void
+zram_load(uint64 idx, void *pa)
+{
+  struct zpage *z;
+  uint64 *p;
+
+  acquire(&zram.lock);
+  z = &zram.tab[idx];
+  if(idx >= ZRAM_PAGES || z->ref == 0)
+    panic("zram_load");
+  if(z->data == 0){
+    for(p = pa; p < (uint64*)((char*)pa + PGSIZE); p++)
+      *p = z->fill;
+  } else if(lz_decompress((uchar*)z->data, z->len, pa) < 0){
+    panic("zram_load: corrupt");
+  }
+  release(&zram.lock);
+}
+
+// 释放交换表项对条目 idx 的引用
+void
+zram_free(uint64 idx)
+{
+  struct zpage *z;
+  int c;
+
+  acquire(&zram.lock);
+  z = &zram.tab[idx];
+  if(idx >= ZRAM_PAGES || z->ref == 0)
+    panic("zram_free");
+  if(--z->ref == 0){
+    if(z->data){
+      c = (z->len - 1) / ZRAM_CLASS;
+      kmem_cache_free(zram.cache[c], z->data);
+      zram.bytes -= (c + 1) * ZRAM_CLASS;
+      z->data = 0;
+    }
+    kstat_add(KSTAT_ZRAM_ORIG, -PGSIZE);
+    kstat_set(KSTAT_ZRAM_COMPR, zram.bytes);
+  }
+  release(&zram.lock);
+}
+
+// fork 复制交换表项时增加条目 idx 的引用数
+void
+zram_dup(uint64 idx)
+{
+  acquire(&zram.lock);
+  if(idx >= ZRAM_PAGES || zram.tab[idx].ref == 0 || zram.tab[idx].ref == 0xff)
+    panic("zram_dup");
+  zram.tab[idx].ref++;
+  release(&zram.lock);
+}
@@ -3,8 +3,6 @@
 #include "../fs/file.h"
 #include "../fs/fs.h"
 
-static int loadseg(pagetable_t pagetable, uint64 va, struct inode *f, uint offset, uint filesz);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -24,6 +22,7 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
+  struct vma *vmas = 0, *oldvmas;
   struct proc *p = myproc();
   uint64 oldsz;
 
@@ -46,7 +45,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record each segment as a file-backed VMA; pages are read
+  // in from the file on first touch (see vma_fault).
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -56,14 +56,18 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    // 用户段只能在 KERNBASE 之下，上面是共享的内核映射
+    if(ph.vaddr + ph.memsz > KERNBASE)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(vma_add(&vmas, ph.vaddr, ph.vaddr + ph.memsz, flags2perm(ph.flags),
+               MAP_PRIVATE, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -73,17 +77,17 @@ exec(char *path, char **argv)
   oldsz = p->sz;
   // printf("[DEBUG] exec: oldsz=%x, p->sz=%x\n", oldsz, p->sz);
 
-  // Allocate some pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the rest as the user stack.
+  // The heap starts at the next page boundary. The stack lives
+  // just below TRAPFRAME: map USERSTACK pages of it now, and let
+  // vmfault() grow it down page by page up to p->stackmax. The
+  // gap below the stack region acts as the guard.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
+  stackbase = USTACKTOP - USERSTACK*PGSIZE;
+  if(vma_add(&vmas, stackbase, USTACKTOP, PTE_W, MAP_PRIVATE|VMA_MMAP|VMA_STACK, 0, 0, 0) < 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
-  sp = sz;
-  stackbase = sp - USERSTACK*PGSIZE;
+  if(uvmalloc(pagetable, stackbase, USTACKTOP, PTE_W) == 0)
+    goto bad;
+  sp = USTACKTOP;
 
   // Copy argument strings into new stack, remember their
   // addresses in ustack[].
@@ -128,41 +132,24 @@ exec(char *path, char **argv)
   oldpagetable = p->pagetable;
   // printf("[DEBUG] exec: before free, oldsz=%x, new sz=%x\n", oldsz, sz);
   p->pagetable = pagetable;  // 切换页表
+  p->asid = 0;               // 新页表需要新的 ASID
   p->sz = sz;
+  oldvmas = p->vma;
+  p->vma = vmas;
+  vma_release(oldpagetable, &oldvmas);       // 解除旧的 mmap 映射
   proc_freepagetable(oldpagetable, oldsz);  // 释放旧页表
   // printf("[DEBUG] exec: after proc_freepagetable\n");
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-  {
-  printf("2\n");
-    proc_freepagetable(pagetable, sz);
-  }
   if(ip){
     iunlockput(ip);
+    vma_free(&vmas);
     end_op();
+  } else if(vmas){
+    vma_release(pagetable, &vmas);   // 也释放已经映射的栈页
   }
+  if(pagetable)
+    proc_freepagetable(pagetable, sz);
   return -1;
 }
-
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint filesz)
-{
-  uint i;
-  uint64 pa;
-
-  for(i = 0; i < filesz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    uint64 sz = filesz - i;
-    if(sz > PGSIZE)
-      sz = PGSIZE;
-    if(readi(ip, 0, pa, offset + i, sz) != sz)
-      return -1;
-    if(va + i + sz < va + i)
-      return -1;
-  }
-  return 0;
-}
\ No newline at end of file
@@ -1,19 +1,138 @@
 #include "proc.h"
 extern char trampoline[];
 
-// 全局进程表和CPU数组
+// 全局进程链表和CPU数组
 struct cpu cpus[NCPU];
-struct proc proc[NPROC];
+struct proc *proclist;          // 所有已分配的进程，按创建顺序（即 pid 顺序）排列
+static struct proc *proctail;
+static int nproc;               // 当前进程数，上限为 NPROC
+static struct kmem_cache *proc_cache;
 struct proc *initproc;
 // PID分配
 static int nextpid = 1;
 
+// proc_lock 保护进程链表、nproc 和 nextpid。持有它时链表上的进程
+// 不会被释放。p->lock 保护 p->state 等调度相关的字段，持有它时
+// 不在运行的进程不会开始运行。
+// wait_lock 保护各进程的 parent 和子进程链表，保证 wait() 不会错过
+// 子进程退出时的 wakeup。加锁顺序：wait_lock（和其他条件锁）、
+// proc_lock、等待队列的锁、p->lock、运行队列的锁。
+struct spinlock proc_lock;
+static struct spinlock wait_lock;
+static struct proc *pidhash[PIDHASH];  // 按 pid 散列，由 proc_lock 保护
+
+// 等待队列：SLEEPING 的进程按 chan 散列到 waitq[] 中，wakeup 只查看
+// 同一个桶里的进程。p->wq 是进程所在的队列，只在持有该队列的锁
+// 时修改。进入和离开 SLEEPING 都先拿队列的锁再拿 p->lock，所以持有
+// 队列的锁时其中睡眠进程的 chan 不会变。例外是
+// wakeup_proc()：它的调用者可能持有别的进程的锁，不能再拿队列的锁，
+// 只把进程改为 RUNNABLE，留在队列中的过期表项由之后遍历到它的人
+// 或进程自己下一次睡眠时摘除。
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+};
+static struct waitq waitq[NWAITQ];
+
+static struct waitq*
+waitq_hash(void *chan)
+{
+  uint64 h = (uint64)chan * 0x9e3779b97f4a7c15UL;
+  return &waitq[(h >> 32) % NWAITQ];
+}
+
+// 每个CPU的运行队列和空闲优先级线程的队列（见 scheduler()）
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int len;
+};
+static struct runq runq[NCPU];
+static struct runq idleq;
+
+static void
+runq_init(struct runq *q, char *name)
+{
+  initlock(&q->lock, name);
+  q->head = q->tail = 0;
+  q->len = 0;
+}
+
+static void setrunnable(struct proc*);
+
+// 把 p 挂到等待队列 q 上。调用者持有 q->lock 和 p->lock。
+static void
+waitq_add(struct waitq *q, struct proc *p)
+{
+  p->wprev = 0;
+  p->wnext = q->head;
+  if(q->head)
+    q->head->wprev = p;
+  q->head = p;
+  p->wq = q;
+}
+
+// 从所在的等待队列摘下 p。调用者持有 p->wq->lock。
+static void
+waitq_del(struct proc *p)
+{
+  if(p->wprev)
+    p->wprev->wnext = p->wnext;
+  else
+    p->wq->head = p->wnext;
+  if(p->wnext)
+    p->wnext->wprev = p->wprev;
+  p->wq = 0;
+}
+
+// 摘除不在睡眠的 p 留在等待队列中的过期表项（见 wakeup_proc）。
+// 只由 p 自己或在 p 不可能再运行时调用，此时没有人会把它挂上队列。
+static void
+waitq_detach(struct proc *p)
+{
+  struct waitq *q;
+
+  while((q = p->wq) != 0){
+    acquire(&q->lock);
+    if(p->wq == q)
+      waitq_del(p);
+    release(&q->lock);
+  }
+}
+
+// 把 c 挂到 parent 的子进程链表头部。调用者持有 wait_lock。
+static void
+child_add(struct proc *parent, struct proc *c)
+{
+  c->parent = parent;
+  c->psibling = 0;
+  c->sibling = parent->children;
+  if(parent->children)
+    parent->children->psibling = c;
+  parent->children = c;
+}
+
+// 从父进程的子进程链表摘下 c。调用者持有 wait_lock。
+static void
+child_del(struct proc *c)
+{
+  if(c->psibling)
+    c->psibling->sibling = c->sibling;
+  else
+    c->parent->children = c->sibling;
+  if(c->sibling)
+    c->sibling->psibling = c->psibling;
+  c->parent = 0;
+}
+
 // 进程表查找
 struct proc* myproc(void);
 
 // ============================================================================
 // 任务1：PID分配策略
 // 设计：简单递增策略，考虑回绕
+// 调用者持有 proc_lock
 // ============================================================================
 
 int
@@ -29,39 +148,43 @@ allocpid(void)
 
 // ============================================================================
 // 任务2：进程查找和管理
-// 设计：使用数组实现进程表，简单但高效
-// 优点：O(1)索引访问，内存连续，缓存友好
-// 缺点：固定大小，查找特定PID需要O(n)
+// 设计：进程结构从 slab 缓存按需分配，挂在全局双向链表 proclist 上
+// 优点：内存随进程数增减，NPROC 只是上限而非静态占用
+// 按 PID 查找走哈希表 pidhash，每个进程的子进程另有链表，
+// wait/exit 和 kill 都不需要遍历整个进程链表
 // ============================================================================
 
 // 返回当前CPU上运行的进程
 struct proc*
 myproc(void)
 {
-  // 在单CPU系统中，直接返回cpus[0].proc
-  // push_off();
-  struct cpu *c = &cpus[0];
+  // 关中断，读 c->proc 时不会被调度到其他CPU上
+  push_off();
+  struct cpu *c = mycpu();
   struct proc *p = c->proc;
-  // pop_off();
+  pop_off();
   return p;
 }
 
 // 获取当前CPU
+// 必须关中断，防止读出CPU编号之后被调度到其他CPU上
 struct cpu*
 mycpu(void)
 {
-  // 单CPU系统
-  return &cpus[0];
+  int id = cpuid();
+  return &cpus[id];
 }
 
-// 通过PID查找进程 - O(n)复杂度
-// 优化方案：可以使用哈希表将复杂度降至O(1)
+// 通过PID查找进程，在 pidhash 的一条链上查找
+// 调用者持有 proc_lock
 struct proc*
 find_proc_by_pid(int pid)
 {
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
+
+  if(pid <= 0)
+    return 0;
+  for(p = pidhash[pid % PIDHASH]; p; p = p->pidnext) {
     if(p->pid == pid) {
       return p;
     }
@@ -69,10 +192,49 @@ find_proc_by_pid(int pid)
   return 0;
 }
 
+// 不在运行的用户进程，可以由扫描者检查它的页表
+static int
+proc_scannable(struct proc *p)
+{
+  return (p->state == RUNNABLE || p->state == SLEEPING) &&
+         p->kfn == 0 && p->pagetable != 0;
+}
+
+// 返回 pid 不小于 pid 的用户进程中 pid 最小的一个，没有则返回 0。
+// kswapd、ksmd 按 pid 顺序遍历所有用户地址空间时使用。正在运行的
+// 进程也跳过：它可能在其他CPU上使用自己的页表。调用者持有
+// proc_lock，返回的进程已加上 p->lock，在释放之前不会开始运行，
+// 也不会被释放。
+// 扫描者每一页都调用一次，多数时候仍停留在同一个进程中，所以先按
+// pid 在 pidhash 中查找，只有换到下一个进程时才遍历进程链表。
+struct proc*
+proc_next_user(int pid)
+{
+  struct proc *p;
+
+  // 先不加锁检查，加锁后再确认，期间开始运行了就找下一个
+  if((p = find_proc_by_pid(pid)) != 0 && proc_scannable(p)){
+    acquire(&p->lock);
+    if(proc_scannable(p))
+      return p;
+    release(&p->lock);
+  }
+  // 链表按 pid 递增排列，第一个符合条件的就是 pid 最小的
+  for(p = proclist; p; p = p->next){
+    if(p->pid < pid || !proc_scannable(p))
+      continue;
+    acquire(&p->lock);
+    if(proc_scannable(p))
+      return p;
+    release(&p->lock);
+  }
+  return 0;
+}
+
 // ============================================================================
 // 任务3：进程创建 - allocproc()
 // 核心功能：
-// 1. 在进程表中查找UNUSED槽位
+// 1. 从 slab 缓存分配进程结构并挂入进程链表
 // 2. 分配PID
 // 3. 分配trapframe
 // 4. 分配用户页表
@@ -83,22 +245,42 @@ struct proc*
 allocproc(void)
 {
   struct proc *p;
-  int slot = 0;
 
-  // 遍历进程表查找空闲槽位
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p->state == UNUSED) {
-      goto found;
-    }
-    slot++;
+  if((p = kmem_cache_alloc(proc_cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+
+  acquire(&proc_lock);
+  if(nproc >= NPROC){
+    release(&proc_lock);
+    kmem_cache_free(proc_cache, p);
+    return 0;  // 进程数已达上限
   }
-  return 0;  // 进程表已满
-
-found:
-  // printf("[ALLOC] allocating slot=%d\n", slot);
+  // 挂到链表尾部，链表按 pid 排序
+  p->prev = proctail;
+  p->next = 0;
+  if(proctail)
+    proctail->next = p;
+  else
+    proclist = p;
+  proctail = p;
+  nproc++;
+
+  // printf("[ALLOC] allocating proc, nproc=%d\n", nproc);
+  // USED 状态的进程不会被调度，也不会被 kswapd 等扫描
   p->pid = allocpid();
+  p->pidnext = pidhash[p->pid % PIDHASH];
+  pidhash[p->pid % PIDHASH] = p;
   p->state = USED;
+  release(&proc_lock);
+
   p->sz = 0;  // 初始化进程大小为0
+  p->stackmax = USTACKMAX;
+  // 默认在创建者（fork 的父进程）的CPU上运行
+  push_off();
+  p->cpu = cpuid();
+  pop_off();
   p->parent = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -108,7 +290,7 @@ found:
     p->ofile[i] = 0;
   }
   // 分配trapframe页
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  if((p->trapframe = (struct trapframe *)kalloc_nozero()) == 0){
     freeproc(p);
     return 0;
   }
@@ -125,7 +307,7 @@ found:
 
   // 分配内核栈
   // 注意：这里假设已经在虚拟内存中映射了内核栈区域
-  if((p->kstack = (uint64)kalloc()) == 0) {
+  if((p->kstack = (uint64)kalloc_nozero()) == 0) {
     freeproc(p);
     return 0;
   }
@@ -136,7 +318,6 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
   strcpy(p->name, "allocproc");
-  p->wake_time = 0;
   
   // 调试：确保 context.ra 被正确设置
   if(p->context.ra == 0) {
@@ -155,7 +336,7 @@ found:
 void
 freeproc(struct proc *p)
 {
-  // printf("[FREE] freeing slot=%d pid=%d\n", slot, p->pid);
+  // printf("[FREE] freeing pid=%d\n", p->pid);
   
   if(p->trapframe)
     kfree((void*)p->trapframe);
@@ -181,14 +362,37 @@ freeproc(struct proc *p)
   memset(&p->context, 0, sizeof(p->context));
   
   p->sz = 0;
-  p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
-  p->wake_time = 0;
   p->xstate = 0;
+
+  // 被 wakeup_proc() 唤醒过的进程可能还留在等待队列中
+  waitq_detach(p);
+
+  // 从进程链表摘下并归还 slab。进程是 USED 或已被回收的 ZOMBIE，
+  // 不会被调度，其他CPU只可能在持有 proc_lock 遍历链表时看到它。
+  acquire(&proc_lock);
   p->state = UNUSED;
+  for(struct proc **pp = &pidhash[p->pid % PIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pid = 0;
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    proclist = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  else
+    proctail = p->prev;
+  nproc--;
+  release(&proc_lock);
+  kmem_cache_free(proc_cache, p);
 }
 
 // ============================================================================
@@ -209,7 +413,7 @@ proc_pagetable(struct proc *p)
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-    (uint64)trampoline, PTE_R | PTE_X) < 0){
+    (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0){
      uvmfree(pagetable, 0);
   return 0;
 }
@@ -223,6 +427,8 @@ uvmfree(pagetable, 0);
 return 0;
 }
 
+  // 共享内核 RAM 的映射，copyin/copyout 可以直接访问用户地址
+  uvmkshare(pagetable);
 
   return pagetable;
 }
@@ -234,6 +440,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
   // 先清除 TRAMPOLINE 和 TRAPFRAME 的映射（不释放物理页）
   // 必须在释放用户内存之前清除，因为 walk 需要访问页表
   pte_t *pte;
+  uvmkunshare(pagetable);
   if((pte = walk(pagetable, TRAMPOLINE, 0)) != 0 && (*pte & PTE_V))
     *pte = 0;
   
@@ -250,20 +457,24 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 
 // ============================================================================
 // 任务6：进程初始化
-// 在系统启动时调用，初始化进程表
+// 在系统启动时调用，初始化进程链表和进程结构的 slab 缓存
 // ============================================================================
 
 void
 procinit(void)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    p->state = UNUSED;
-    p->kstack = 0;
-    // 初始化进程锁 
-    memset(p, 0, sizeof(struct proc));
-  }
+  initlock(&proc_lock, "proclist");
+  initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  for(int i = 0; i < NCPU; i++)
+    runq_init(&runq[i], "runq");
+  runq_init(&idleq, "idleq");
+  proclist = proctail = 0;
+  nproc = 0;
+  proc_cache = kmem_cache_create("proc", sizeof(struct proc), 0);
+  if(proc_cache == 0)
+    panic("procinit");
 }
 
 // ============================================================================
@@ -285,24 +496,125 @@ userinit(void)
   if(p == 0)
   panic("userinit: allocproc failed");
 
-  p->state = RUNNABLE;
+  acquire(&p->lock);
+  setrunnable(p);
+  release(&p->lock);
+
+}
+
+// ============================================================================
+// 内核线程
+// 只在内核态运行的进程，不会返回用户态；fn 不应返回
+// ============================================================================
+
+static void
+kthread_start(void)
+{
+  struct proc *p = myproc();
 
+  // 调度器切换过来时持有 p->lock
+  release(&p->lock);
+  intr_on();
+  p->kfn();
+  panic("kthread: fn returned");
+}
+
+// 创建一个内核线程。idle 非零时以空闲优先级调度。
+struct proc*
+kthread_create(char *name, void (*fn)(void), int idle)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->kfn = fn;
+  p->idle = idle;
+  p->context.ra = (uint64)kthread_start;
+  acquire(&p->lock);
+  setrunnable(p);
+  release(&p->lock);
+  return p;
 }
 
 // ============================================================================
 // 任务8：进程调度 - scheduler()
-// 实现轮转调度算法（Round-Robin）
+// 每个CPU一个运行队列，实现轮转调度算法（Round-Robin）
 // 设计考虑：
-// 1. 简单公平：每个进程轮流执行
-// 2. 避免忙等：开启中断，允许设备工作
-// 3. 多核支持：每个CPU独立调度
+// 1. 亲和性：RUNNABLE 的进程排在它上次运行的CPU（p->cpu）的队列中，
+//    被唤醒、让出CPU后回到原来的CPU；fork 出的子进程留在父进程的CPU上
+// 2. 负载均衡：本地队列为空时从最长的队列头部偷一个进程
+// 3. 避免忙等：没有可运行进程时 wfi 等待中断
+// 4. 多核支持：运行进程时持有 p->lock，进程切换回来时也持有它
+//    （见 sched()），其他CPU不会同时运行同一个进程
+// 5. 空闲优先级：p->idle 的内核线程排在全局的 idleq 中，只在没有
+//    其他可运行进程时运行
+// 进程在队列中当且仅当它的状态是 RUNNABLE。入队时持有 p->lock，
+// 出队时不持有（加锁顺序是 p->lock、队列锁），出队后再锁 p；这期间
+// 它仍是 RUNNABLE，不会被再次入队或释放。
 // ============================================================================
 
+// 把进程 p 设为 RUNNABLE，排到它所属队列的尾部。调用者持有 p->lock。
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *q = p->idle ? &idleq : &runq[p->cpu];
+
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  p->rqnext = 0;
+  if(q->tail)
+    q->tail->rqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  q->len++;
+  release(&q->lock);
+}
+
+// 取出队列头部的进程，队列为空返回 0
+static struct proc*
+runq_pop(struct runq *q)
+{
+  struct proc *p;
+
+  acquire(&q->lock);
+  if((p = q->head) != 0){
+    q->head = p->rqnext;
+    if(q->head == 0)
+      q->tail = 0;
+    q->len--;
+  }
+  release(&q->lock);
+  return p;
+}
+
+// CPU id 的队列为空时，从其他CPU中最长的队列偷一个进程
+static struct proc*
+runq_steal(int id)
+{
+  struct proc *p;
+  int i, busiest = -1, len = 0;
+
+  // 不加锁读取长度，只用来选择目标
+  for(i = 0; i < NCPU; i++){
+    if(i != id && runq[i].len > len){
+      busiest = i;
+      len = runq[i].len;
+    }
+  }
+  if(busiest < 0 || (p = runq_pop(&runq[busiest])) == 0)
+    return 0;
+  kstat_inc(KSTAT_SCHED_STEAL);
+  return p;
+}
+
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
 
   c->proc = 0;
   for(;;){
@@ -311,24 +623,40 @@ scheduler(void)
     // processes are waiting. Then turn them back off
     // to avoid a possible race between an interrupt
     // and wfi.
-    // intr_on();
-    // printf("scheduler start\n");
-    for(p = proc; p < &proc[NPROC]; p++) {
-     
-      if(p->state == RUNNABLE) {
-        // printf("scheduler: process %d is runnable\n", p->pid);
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    intr_on();
+    intr_off();
+
+    // 没有普通进程可运行时才调度空闲优先级的内核线程
+    if((p = runq_pop(&runq[id])) == 0 && (p = runq_steal(id)) == 0){
+      kzero_kick();
+      p = runq_pop(&idleq);
+    }
+    if(p == 0){
+      // nothing to run; stop running on this core until an interrupt.
+      asm volatile("wfi");
+      continue;
+    }
+
+    // 进程可能还在原来的CPU上切换出来，等它的 p->lock
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if(p->cpu != id){
+      kstat_inc(KSTAT_SCHED_MIGRATE);
+      p->cpu = id;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -344,10 +672,11 @@ yield(void)
   if(p == 0)
     return;
   // printf("yield: %d\n", p->state);
-    
-  p->state = RUNNABLE;
-  sched();
 
+  acquire(&p->lock);
+  setrunnable(p);
+  sched();
+  release(&p->lock);
 }
 
 // ============================================================================
@@ -355,29 +684,38 @@ yield(void)
 // 从进程上下文切换回调度器
 // 安全检查：
 // 1. 确保持有进程锁
-// 2. 确保中断已关闭
-// 3. 确保不是在中断中调度
+// 2. 确保中断已关闭，且没有持有其他自旋锁
+// 3. 确保进程已不在运行状态
+// intena 是这个内核线程的属性而不是这个CPU的，需要保存和恢复。
 // ============================================================================
 
 void
 sched(void)
 {
+  int intena;
   struct proc *p = myproc();
-  struct cpu *c = mycpu();
   if(p == 0)
     panic("sched: no proc");
 
   // 安全检查
+  if(!holding(&p->lock))
+    panic("sched p->lock");
+  if(mycpu()->noff != 1)
+    panic("sched locks");
   if(p->state == RUNNING)
   {
     // printf("sched: process running %s\n", p->name);
     panic("sched: process running");
   }
+  if(intr_get())
+    panic("sched interruptible");
 
   // printf("sched: proc %d\n", p->pid);
 
   // 切换回调度器上下文
-  swtch(&p->context, &c->context);
+  intena = mycpu()->intena;
+  swtch(&p->context, &mycpu()->context);
+  mycpu()->intena = intena;
 }
 
 // ============================================================================
@@ -385,43 +723,95 @@ sched(void)
 // 实现条件变量机制，解决生产者-消费者问题
 // 
 // sleep设计：
-// 1. 原子地释放锁并睡眠
-// 2. 避免lost wakeup问题
-// 3. 被唤醒后重新获取锁
+// 1. 持有 p->lock 改变状态并切换到调度器，wakeup 也要先拿到 p->lock，
+//    不会在设置 SLEEPING 和切换之间把进程改回 RUNNABLE
+// 2. 睡眠的进程挂在按 chan 散列的等待队列上，wakeup 的开销和
+//    等待者的数目成正比，没有等待者时不用加锁
+// 3. sleep_lock 在挂上等待队列之后才释放条件锁，持有条件锁的
+//    wakeup_lock 一定能看到它，避免 lost wakeup
+// 4. 不带条件锁的 sleep() 由调用者容忍丢失的唤醒（下一次唤醒会补上）
 // ============================================================================
 
-void
-sleep(void *chan)
+// 在 chan 上睡眠，lk 非零时是要释放的条件锁
+static void
+sleep_on(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  
-  if(p == 0)
-    panic("sleep: no proc");
+  struct waitq *q = waitq_hash(chan);
+
+  waitq_detach(p);
+  acquire(&q->lock);
+  acquire(&p->lock);
 
-  // 必须持有进程锁才能改变状态
   p->chan = chan;
   p->state = SLEEPING;
+  waitq_add(q, p);
+  if(lk)
+    release(lk);
+  release(&q->lock);
 
   // 切换到调度器
   sched();
 
   // 被唤醒后，清除chan
   p->chan = 0;
+  release(&p->lock);
+  if(lk)
+    acquire(lk);
+}
+
+// 唤醒等待 chan 的进程，跳过 skip
+static void
+wakeup_chan(void *chan, struct proc *skip)
+{
+  struct waitq *q = waitq_hash(chan);
+  struct proc *p, *next;
+
+  // 调用者持有条件锁时，睡眠者在释放条件锁之前已经挂上队列，
+  // 这里一定能看到；不持有条件锁的 wakeup() 本来就可能错过
+  if(q->head == 0)
+    return;
+  acquire(&q->lock);
+  for(p = q->head; p; p = next){
+    next = p->wnext;
+    // 队列中睡眠进程的 chan 不会变，先不加锁过滤
+    if(p == skip || p->chan != chan)
+      continue;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan)
+      setrunnable(p);
+    if(p->state != SLEEPING)
+      waitq_del(p);
+    release(&p->lock);
+  }
+  release(&q->lock);
+}
+
+void
+sleep(void *chan)
+{
+  if(myproc() == 0)
+    panic("sleep: no proc");
+  sleep_on(chan, 0);
 }
 
 // 唤醒所有等待chan的进程
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeup_chan(chan, myproc());
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-    }
-  }
+// 只唤醒进程 p（如果它在等待 chan）。不拿等待队列的锁，调用者可以
+// 持有 proc_lock 和其他进程的 p->lock，例如从 kswapd 等扫描者的
+// 临界区中分配内存时。p 留在等待队列中，稍后摘除（见 waitq）。
+void
+wakeup_proc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    setrunnable(p);
+  release(&p->lock);
 }
 
 // ============================================================================
@@ -437,6 +827,7 @@ exit(int status)
 {
   struct proc *p = myproc();
   struct proc *pp;
+  int reparented = 0;
 
   if(p == 0)
     panic("exit: no proc");
@@ -452,7 +843,8 @@ exit(int status)
     }
   }
   
-  // 释放当前工作目录
+  // 解除 mmap 映射（写回共享映射的脏页），释放 VMA 和当前工作目录
+  vma_release(p->pagetable, &p->vma);
   begin_op();
   if(p->cwd) {
     iput(p->cwd);
@@ -460,21 +852,29 @@ exit(int status)
   }
   end_op();
 
-  p->xstate = status;
-  p->state = ZOMBIE;
+  acquire(&wait_lock);
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;  // init进程
-      if(initproc)
-        wakeup(initproc);
-    }
+  // 子进程交给 init进程
+  while((pp = p->children) != 0){
+    child_del(pp);
+    if(initproc && initproc != p)
+      child_add(initproc, pp);
+    reparented = 1;
   }
+  if(reparented && initproc)
+    wakeup(initproc);
 
   // 唤醒父进程
   if(p->parent)
     wakeup(p->parent);
 
+  acquire(&p->lock);
+  p->xstate = status;
+  p->state = ZOMBIE;
+
+  // 父进程要拿到 p->lock 才能看到 ZOMBIE，那时已经切换走了
+  release(&wait_lock);
+
   // 跳转到调度器，不再返回
   sched();
   panic("exit: zombie exit");
@@ -490,42 +890,47 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *pp;
+  struct proc *pp, *zombie;
   int havekids;
-  int pid;
+  int pid, xstate;
   struct proc *p = myproc();
 
+  acquire(&wait_lock);
   for(;;){
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        havekids = 1;
-        
-        if(pp->state == ZOMBIE){
-          // 找到僵尸子进程
-          pid = pp->pid;
-          // printf("[WAIT] pid=%d reaping zombie child pid=%d\n", p->pid, pid);
-          if(addr != 0) {
-            // 复制退出状态到用户空间
-            // TODO: copyout to user space
-            if(copyout(p->pagetable, addr, (char *)&pp->xstate, sizeof(pp->xstate)) < 0){
-              return -1;
-            }
-          }
-          freeproc(pp);
-          // printf("[WAIT] pid=%d freed child pid=%d\n", p->pid, pid);
-          return pid;
-        }
-      }
+    // 子进程只由父进程在持有 wait_lock 时回收，遍历时不会被释放
+    havekids = p->children != 0;
+    zombie = 0;
+    for(pp = p->children; pp && !zombie; pp = pp->sibling){
+      // 拿到锁时子进程如果是 ZOMBIE，它已经完全切换走了
+      acquire(&pp->lock);
+      if(pp->state == ZOMBIE)
+        zombie = pp;
+      release(&pp->lock);
+    }
+
+    if(zombie){
+      // 找到僵尸子进程
+      pid = zombie->pid;
+      xstate = zombie->xstate;
+      // printf("[WAIT] pid=%d reaping zombie child pid=%d\n", p->pid, pid);
+      child_del(zombie);
+      freeproc(zombie);
+      release(&wait_lock);
+      // 复制退出状态到用户空间。copyout 可能缺页睡眠，不能持有自旋锁，
+      // 所以先回收子进程
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0)
+        return -1;
+      return pid;
     }
 
     // 没有子进程
-    if(!havekids){
+    if(!havekids || killed(p)){
+      release(&wait_lock);
       return -1;
     }
 
     // 等待子进程退出
-    sleep(p);
+    sleep_lock(p, &wait_lock);
   }
 }
 
@@ -558,6 +963,25 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  np->stackmax = p->stackmax;
+
+  // 复制文件映射区域，未调入的页由子进程自己缺页读入
+  if(vma_dup(&np->vma, p->vma) < 0){
+    freeproc(np);
+    return -1;
+  }
+
+  // mmap 区域在 sz 之上，uvmcopy 没有复制：共享映射与父进程
+  // 共用物理页，私有映射写时复制
+  for(struct vma *v = p->vma; v; v = v->next){
+    if((v->flags & VMA_MMAP) == 0)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->start, v->end, v->flags & MAP_SHARED) < 0){
+      vma_release(np->pagetable, &np->vma);
+      freeproc(np);
+      return -1;
+    }
+  }
 
   // 复制trapframe
   *(np->trapframe) = *(p->trapframe);
@@ -578,12 +1002,17 @@ fork(void)
   if(p->cwd)
     np->cwd = idup(p->cwd);
 
-  np->parent = p;
   strcpy(np->name, p->name);
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  acquire(&wait_lock);
+  child_add(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
 
   // printf("[FORK] fork complete, child pid=%d\n", pid);
   return pid;
@@ -601,6 +1030,8 @@ forkret(void)
   static int first = 1;
   struct proc *p = myproc();
 
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
 
   if (first) {
     // File system initialization must be run in the context of a
@@ -645,6 +1076,8 @@ forkret(void)
 // ============================================================================
 // 任务16：进程增长 - growproc()
 // 增长或缩小进程的用户内存
+// 增长是惰性的：只移动 p->sz，页在第一次访问时由 vmfault()
+// 分配并清零；缩小时立即释放已分配的页。
 // ============================================================================
 
 int
@@ -655,10 +1088,13 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n,PTE_W)) == 0) {
+    // 用户地址不能进入内核直接映射区，那里的 TLB 表项是全局的
+    if(sz + n < sz || sz + n > KERNBASE)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    if((uint64)-n > sz)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
@@ -674,123 +1110,85 @@ int
 kill(int pid)
 {
   struct proc *p;
+  struct waitq *q;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // 唤醒进程，让它检查killed标志
-        p->state = RUNNABLE;
-      }
-      return 0;
-    }
+  acquire(&proc_lock);
+  if((p = find_proc_by_pid(pid)) == 0){
+    release(&proc_lock);
+    return -1;
+  }
+  // 睡眠的进程要先拿它所在等待队列的锁。不加锁读出的 p->wq 可能
+  // 已经过时，拿到锁后进程仍在睡眠但换了队列就重来
+  for(;;){
+    if((q = p->wq) != 0)
+      acquire(&q->lock);
+    acquire(&p->lock);
+    if(p->state != SLEEPING || p->wq == q)
+      break;
+    release(&p->lock);
+    if(q)
+      release(&q->lock);
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // 唤醒进程，让它检查killed标志
+    waitq_del(p);
+    setrunnable(p);
+  }
+  release(&p->lock);
+  if(q)
+    release(&q->lock);
+  release(&proc_lock);
+  return 0;
 }
 
 // 检查当前进程是否被杀死
 int
 killed(struct proc *p)
 {
-  return p->killed;
+  int k;
+
+  acquire(&p->lock);
+  k = p->killed;
+  release(&p->lock);
+  return k;
 }
 
 void
 setkilled(struct proc *p)
 {
+  acquire(&p->lock);
   p->killed = 1;
+  release(&p->lock);
 }
 
 // ============================================================================
 // 任务18：CPU ID - cpuid()
-// 返回当前CPU的ID
+// 返回当前CPU的ID：start() 把 hartid 放在 tp 中，内核中 tp 不作他用，
+// 从用户态陷入时 trampoline 从 trapframe 恢复它。
+// 必须关中断，防止读出之后被调度到其他CPU上
 // ============================================================================
 
 int
 cpuid()
 {
-  // 单CPU系统，总是返回0
-  return 0;
-}
-
-
-
-// ============================================================================
-// 基于时间的睡眠 - sleep_ticks()
-// 让进程睡眠指定的时钟周期数
-// ============================================================================
-
-void
-sleep_ticks(uint64 ticks)
-{
-  struct proc *p = myproc();
-  uint64 wake_time;
-  
-  if(p == 0)
-    panic("sleep_ticks: no proc");
-  
-  // 计算唤醒时间（当前时间 + 睡眠时长）
-  wake_time = r_time() + ticks;
-  
-  // 设置唤醒时间和睡眠通道（使用 wake_time 作为唯一标识）
-  p->wake_time = wake_time;
-  p->chan = (void*)wake_time;  // 使用 wake_time 作为 chan
-  p->state = SLEEPING;
-  
-  // 切换到调度器
-  sched();
-  
-  // 被唤醒后，清除 chan
-  p->chan = 0;
-  p->wake_time = 0;
+  int id = r_tp();
+  return id;
 }
 
-// ============================================================================
-// 唤醒所有到期的睡眠进程
-// 在定时器中断中调用
-// ============================================================================
 
-void
-wakeup_timer(void)
-{
-  struct proc *p;
-  uint64 now = r_time();
-  
-  // 遍历所有进程，唤醒到期的进程
-  for(p = proc; p < &proc[NPROC]; p++){
-  
-    if(p->state == SLEEPING && p->wake_time != 0) {
-      if(now >= p->wake_time) {
-        // 时间到了，唤醒进程
-        p->state = RUNNABLE;
-        p->wake_time = 0;
-      }
-    }
-  }
-}
 
+// Atomically release lock lk and sleep on chan.
+// Reacquires lk when awakened.
 void
 sleep_lock(void *chan, struct spinlock *lk)
 {
-  struct proc *p = myproc();
-  
-  if(p == 0)
+  if(myproc() == 0)
     panic("sleep_lock: no proc");
-  
-  // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
-  
-  // Release the lock before sleeping, so interrupt handler can acquire it
-  release(lk);
-  
-  sched();
-  
-  // Tidy up.
-  p->chan = 0;
 
-  // Reacquire original lock after waking up
-  acquire(lk);
+  // lk is released only after we are on the wait queue, so a
+  // wakeup_lock() by a holder of lk will find us.
+  sleep_on(chan, lk);
 }
 
 // Wake up all processes sleeping on channel chan.
@@ -798,15 +1196,10 @@ sleep_lock(void *chan, struct spinlock *lk)
 void
 wakeup_lock(void *chan)
 {
-  struct proc *p;
-
-  // Check all processes, including the current one (if any)
-  // In interrupt context, myproc() may return the sleeping process
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
-    }
-  }
+  // Check all processes, including the current one (if any):
+  // in interrupt context myproc() is the interrupted process, which
+  // does not hold its own p->lock.
+  wakeup_chan(chan, 0);
 }
 int
 either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
@@ -35,6 +35,8 @@ struct context {
     struct context context;     // swtch() here to enter scheduler().
     int noff;                   // Depth of push_off() nesting.
     int intena;                 // Were interrupts enabled before push_off()?
+    uint64 slice_end;           // 当前时间片结束的时刻（见 clockintr）
+    int resched;                // 时间片用完，时钟中断返回前让出CPU
   };
   
   extern struct cpu cpus[NCPU];
@@ -91,10 +93,25 @@ struct context {
 
   };
   
+  // 用户地址空间中由文件支撑的区域（见 mm/vma.c）
+  struct vma {
+    uint64 start;                // 起始地址，页对齐
+    uint64 end;                  // 结束地址（不含），页对齐
+    int perm;                    // PTE_W / PTE_X，映射时再加 PTE_R|PTE_U
+    int flags;                   // MAP_SHARED / MAP_PRIVATE，以及 VMA_MMAP
+    struct inode *ip;            // 文件，0 表示匿名区域
+    uint64 off;                  // start 对应的文件偏移
+    uint64 filesz;               // 从文件读入的字节数，之后的部分为零
+    struct vma *next;            // 按 start 排序的链表
+  };
+  #define VMA_MMAP 0x100             // 由 mmap() 建立，位于 sz 之上
+  #define VMA_STACK 0x200            // 用户栈，缺页时向下增长（见 vma_growstack）
+
   enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
   
   // Per-process state
   struct proc {
+    struct spinlock lock;
   
     // p->lock must be held when using these:
     enum procstate state;        // Process state
@@ -103,8 +120,16 @@ struct context {
     int xstate;                  // Exit status to be returned to parent's wait
     int pid;                     // Process ID
   
-    // wait_lock must be held when using this:
+    // wait_lock must be held when using these:
     struct proc *parent;         // Parent process
+    struct proc *children;       // 子进程链表
+    struct proc *sibling;        // 父进程的子进程链表中的下一个
+    struct proc *psibling;       // 上一个，0 表示是链表头
+
+    // the wait queue's lock must be held when using these（见 proc.c）:
+    struct waitq *wq;            // 所在的等待队列，0 表示不在队列中
+    struct proc *wnext;
+    struct proc *wprev;
   
     // these are private to the process, so p->lock need not be held.
     uint64 kstack;               // Virtual address of kernel stack
@@ -115,6 +140,22 @@ struct context {
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
     char name[16];               // Process name (debugging)
-    uint64 wake_time; 
+    struct timer timer;          // sleep_ticks() 用的定时器
+    void (*kfn)(void);           // 内核线程入口（仅内核线程）
+    int idle;                    // 空闲优先级，仅在没有其他可运行进程时调度
+    int cpu;                     // 上次运行（或将要运行）的CPU，决定排在哪个运行队列
+    struct proc *rqnext;         // 运行队列中的下一个进程
+    uint64 asid;                 // 地址空间标识，高位为分配时的代数（见 vm.c）
+    struct vma *vma;             // 文件映射区域链表
+    uint64 stackmax;             // 用户栈最多能增长到的字节数
+    struct memstat mstat;        // 内存统计（见 memstat.c）
+
+    // 全局进程链表 proclist 和 pid 哈希链，由 proc_lock 保护
+    struct proc *next;
+    struct proc *prev;
+    struct proc *pidnext;
   };
+
+  extern struct proc *proclist;
+  extern struct spinlock proc_lock;
   
\ No newline at end of file
@@ -1,5 +1,5 @@
 #include "proc.h"
-extern struct proc proc[NPROC];
+extern struct proc *proclist;
 // ============================================================================
 // 进程管理系统测试套件
 // ============================================================================
@@ -326,8 +326,7 @@ void debug_proc_table(void)
   printf("│ PID  │ Name           │ State    │ Parent │\n");
   printf("├──────┼────────────────┼──────────┼────────┤\n");
   
-  for(int i = 0; i < NPROC; i++) {
-    struct proc *p = &proc[i];
+  for(struct proc *p = proclist; p; p = p->next) {
     if(p->state != UNUSED) {
       const char *state_str;
       switch(p->state) {
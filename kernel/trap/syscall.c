@@ -11,6 +11,9 @@ extern int exec(char *path, char **argv);
 
 #define BACKSPACE 0x100
 
+// 内核统计计数器，编号见 def.h 中的 KSTAT_*
+uint64 kstat[KSTAT_NR];
+
 // 具体的系统调用实现函数
 uint64 sys_exit(void) {
     int status;
@@ -430,6 +433,70 @@ uint64 sys_mkdir(void) {
     return 0;
 }
 
+// 读取内核统计计数器：kstat(id)，id 非法时返回 -1
+uint64 sys_kstat(void) {
+    struct proc *p = myproc();
+    int id = p->trapframe->a0;
+
+    if(id < 0 || id >= KSTAT_NR)
+        return -1;
+    return __atomic_load_n(&kstat[id], __ATOMIC_RELAXED);
+}
+
+// mmap(addr, len, prot, flags, fd, off)：addr 只是提示，总是由内核
+// 选择地址。MAP_ANONYMOUS 时忽略 fd。失败返回 MAP_FAILED。
+uint64 sys_mmap(void) {
+    struct proc *p = myproc();
+    uint64 len = p->trapframe->a1;
+    int prot = p->trapframe->a2;
+    int flags = p->trapframe->a3;
+    int fd = p->trapframe->a4;
+    uint64 off = p->trapframe->a5;
+    struct file *f;
+    struct inode *ip = 0;
+    int perm = 0;
+
+    if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+        return MAP_FAILED;
+    if(prot & PROT_WRITE)
+        perm |= PTE_W;
+    if(prot & PROT_EXEC)
+        perm |= PTE_X;
+
+    if((flags & MAP_ANONYMOUS) == 0) {
+        if(fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0)
+            return MAP_FAILED;
+        if(f->type != FD_INODE || !f->readable)
+            return MAP_FAILED;
+        // 共享的可写映射会写回文件
+        if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+            return MAP_FAILED;
+        ip = f->ip;
+    }
+
+    return vma_mmap(p, len, perm, flags & (MAP_SHARED|MAP_PRIVATE), ip, off);
+}
+
+// munmap(addr, len)
+uint64 sys_munmap(void) {
+    struct proc *p = myproc();
+
+    return vma_munmap(p, p->trapframe->a0, p->trapframe->a1);
+}
+
+// memstat(pid, st)：把进程 pid（0 表示自己）的内存统计复制到 st
+uint64 sys_memstat(void) {
+    struct proc *p = myproc();
+    int pid = p->trapframe->a0;
+    struct memstat st;
+
+    if(memstat(pid, &st) < 0)
+        return -1;
+    if(copyout(p->pagetable, p->trapframe->a1, (char*)&st, sizeof(st)) < 0)
+        return -1;
+    return 0;
+}
+
 // 系统调用分发函数
 void
 syscall(void)
@@ -456,8 +523,14 @@ syscall(void)
         [SYS_FSTAT]  = sys_fstat,
         [SYS_UNLINK] = sys_unlink,
         [SYS_MKDIR]  = sys_mkdir,
+        [SYS_KSTAT]  = sys_kstat,
+        [SYS_MMAP]   = sys_mmap,
+        [SYS_MUNMAP] = sys_munmap,
+        [SYS_MEMSTAT]= sys_memstat,
     };
 
+    kstat_inc(KSTAT_SYSCALL);
+
     if(num > 0 && num < sizeof(syscalls)/sizeof(syscalls[0]) && syscalls[num]) {
         // 执行系统调用并将返回值放入a0寄存器
         // 验证函数指针不为空
@@ -0,0 +1,177 @@
+// Kernel timers.
+//
+// 待到期的定时器按到期时间放在一个小顶堆中（下标从 1 开始，
+// t->idx 为 0 表示不在堆中）。每个CPU的时钟中断先调用
+// timer_expire() 处理到期的定时器，再把 stimecmp 设为时间片结束和
+// 最早到期时间中较早的一个（timer_next()），所以时钟中断的开销
+// 只和到期的定时器个数有关，与进程数无关。
+//
+// 加入比本CPU下一次时钟中断更早到期的定时器时，直接改写本CPU的
+// stimecmp，到期时总有CPU及时醒来，不必等其他CPU的时间片结束。
+//
+// 回调在时钟中断中、持有 timers.lock 时调用，不能睡眠，也不能
+// 加入或删除定时器。
+
+#include "../include/def.h"
+#include "../proc/proc.h"
+
+static struct {
+  struct spinlock lock;
+  struct timer *heap[NTIMER + 1];
+  int n;
+} timers;
+
+void
+ktimerinit(void)
+{
+  initlock(&timers.lock, "timers");
+}
+
+static void
+heap_set(int i, struct timer *t)
+{
+  timers.heap[i] = t;
+  t->idx = i;
+}
+
+static void
+sift_up(int i)
+{
+  struct timer *t = timers.heap[i];
+
+  while(i > 1 && timers.heap[i/2]->when > t->when){
+    heap_set(i, timers.heap[i/2]);
+    i /= 2;
+  }
+  heap_set(i, t);
+}
+
+static void
+sift_down(int i)
+{
+  struct timer *t = timers.heap[i];
+  int c;
+
+  while((c = 2*i) <= timers.n){
+    if(c < timers.n && timers.heap[c+1]->when < timers.heap[c]->when)
+      c++;
+    if(timers.heap[c]->when >= t->when)
+      break;
+    heap_set(i, timers.heap[c]);
+    i = c;
+  }
+  heap_set(i, t);
+}
+
+// 调用者持有 timers.lock。堆满时返回 -1。
+static int
+timer_insert(struct timer *t)
+{
+  if(t->idx)
+    panic("timer_insert");
+  if(timers.n == NTIMER)
+    return -1;
+  timers.heap[++timers.n] = t;
+  sift_up(timers.n);
+  // 持有自旋锁时关中断，不会换到其他CPU上
+  if(t->when < r_stimecmp())
+    w_stimecmp(t->when);
+  return 0;
+}
+
+// 调用者持有 timers.lock
+static void
+timer_remove(struct timer *t)
+{
+  int i = t->idx;
+  struct timer *last = timers.heap[timers.n--];
+
+  t->idx = 0;
+  if(i <= timers.n){
+    heap_set(i, last);
+    sift_up(i);
+    sift_down(last->idx);
+  }
+}
+
+// 加入定时器 t：到 t->when 时调用 t->fn(t->arg)。待到期的定时器
+// 太多时返回 -1。
+int
+timer_add(struct timer *t)
+{
+  int r;
+
+  acquire(&timers.lock);
+  r = timer_insert(t);
+  release(&timers.lock);
+  return r;
+}
+
+// 删除还没到期的定时器 t，已经到期或不在堆中时什么也不做
+void
+timer_del(struct timer *t)
+{
+  acquire(&timers.lock);
+  if(t->idx)
+    timer_remove(t);
+  release(&timers.lock);
+}
+
+// 调用所有到期的定时器的回调。在每个CPU的时钟中断中调用。
+void
+timer_expire(void)
+{
+  struct timer *t;
+  uint64 now = r_time();
+
+  acquire(&timers.lock);
+  while(timers.n > 0 && (t = timers.heap[1])->when <= now){
+    timer_remove(t);
+    t->fn(t->arg);
+  }
+  release(&timers.lock);
+}
+
+// 返回 limit 和最早到期时间中较早的一个，用来设置下一次时钟中断
+uint64
+timer_next(uint64 limit)
+{
+  acquire(&timers.lock);
+  if(timers.n > 0 && timers.heap[1]->when < limit)
+    limit = timers.heap[1]->when;
+  release(&timers.lock);
+  return limit;
+}
+
+static void
+timer_wakeup(void *chan)
+{
+  wakeup_lock(chan);
+}
+
+// 让当前进程睡眠 ticks 个时间单位（r_time() 的单位）。睡眠用的
+// 定时器就在进程结构中，被 kill() 提前唤醒时删掉它。
+void
+sleep_ticks(uint64 ticks)
+{
+  struct proc *p = myproc();
+  struct timer *t;
+
+  if(p == 0)
+    panic("sleep_ticks: no proc");
+
+  t = &p->timer;
+  t->when = r_time() + ticks;
+  t->fn = timer_wakeup;
+  t->arg = t;
+
+  // 持有 timers.lock 加入定时器并睡眠，回调也在持有它时唤醒，
+  // 到期得再早也不会错过
+  acquire(&timers.lock);
+  if(timer_insert(t) < 0)
+    panic("sleep_ticks: too many timers");
+  sleep_lock(t, &timers.lock);
+  if(t->idx)
+    timer_remove(t);
+  release(&timers.lock);
+}
@@ -37,9 +37,11 @@ void timer_interrupt(void) {
     // uint64 time=get_time();
     // 2. 处理定时器事件
     // printf("time: %d\n", time);
-    // 3. 触发任务调度
-    wakeup_timer();
-    yield();
+    // 3. 时间片用完时触发任务调度（到期的定时器已在 clockintr() 中处理）
+    if(mycpu()->resched){
+      mycpu()->resched = 0;
+      yield();
+    }
     // 4. 递增全局中断计数器
     global_interrupt_count++;
     // 5. 设置下次中断时间
@@ -60,6 +62,16 @@ kerneltrap(struct k_trapframe *tf)
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // copyin/copyout 直接访问用户内存时缺页：跳到修复代码，
+  // 由调用者退回到逐页查页表的慢速路径
+  if(scause == CAUSE_LOAD_PAGE_FAULT || scause == CAUSE_STORE_PAGE_FAULT){
+    uint64 fixup = uaccess_fixup(sepc);
+    if(fixup){
+      w_sepc(fixup);
+      return;
+    }
+  }
+
   // // 检查是中断还是异常
   // if (scause & CAUSE_INTERRUPT_FLAG) {
   //   // 处理中断
@@ -119,12 +131,12 @@ kerneltrap(struct k_trapframe *tf)
     printf("sp=0x%x ra=0x%x\n", r_sp(), r_ra());
     
     // 打印所有进程状态
-    extern struct proc proc[];
+    extern struct proc *proclist;
     printf("\nAll processes:\n");
-    for(struct proc *pp = proc; pp < &proc[NPROC]; pp++) {
+    for(struct proc *pp = proclist; pp; pp = pp->next) {
       if(pp->state != UNUSED) {
-        printf("  slot=%d pid=%d name=%s state=%d\n", 
-               (int)(pp - proc), pp->pid, pp->name, pp->state);
+        printf("  pid=%d name=%s state=%d\n", 
+               pp->pid, pp->name, pp->state);
       }
     }
     
@@ -458,8 +470,11 @@ usertrap(void)
   if(scause & CAUSE_INTERRUPT_FLAG) {
     // 处理中断
     int which_dev=devintr();
-    if(which_dev == 2)
-    yield();
+    // 和内核态一样，只在时间片用完时让出CPU
+    if(which_dev == 2 && mycpu()->resched){
+      mycpu()->resched = 0;
+      yield();
+    }
   } else if(scause == CAUSE_USER_ECALL) {
     // 系统调用
     if(killed(p))
@@ -477,18 +492,20 @@ usertrap(void)
     // 加载访问故障
     printf("usertrap: load access fault at va=%x, pid=%d\n", r_stval(), p->pid);
     setkilled(p);
-  } else if(scause == CAUSE_LOAD_PAGE_FAULT) {
-    // 加载页错误
-    printf("usertrap: load page fault at va=%x, pid=%d\n", r_stval(), p->pid);
-    setkilled(p);
-  } else if(scause == CAUSE_STORE_PAGE_FAULT) {
-    // 存储页错误
-    printf("usertrap: store page fault at va=%x, pid=%d\n", r_stval(), p->pid);
-    setkilled(p);
-  } else if(scause == CAUSE_INSTRUCTION_PAGE_FAULT) {
-    // 指令页错误
-    printf("usertrap: instruction page fault at va=%x, pid=%d\n", r_stval(), p->pid);
-    setkilled(p);
+  } else if(scause == CAUSE_LOAD_PAGE_FAULT ||
+            scause == CAUSE_STORE_PAGE_FAULT ||
+            scause == CAUSE_INSTRUCTION_PAGE_FAULT) {
+    // 页错误：惰性分配页、文件映射页和写时复制页在这里调入，
+    // 其他情况杀死进程。从文件读页可能睡眠等待磁盘，需要开中断。
+    uint64 va = r_stval();
+    int access = scause == CAUSE_STORE_PAGE_FAULT ? FAULT_WRITE :
+                 scause == CAUSE_INSTRUCTION_PAGE_FAULT ? FAULT_EXEC : FAULT_READ;
+    intr_on();
+    if(vmfault(p, va, access) < 0) {
+      printf("usertrap: page fault scause=%d at va=%x, pid=%d\n",
+             (int)scause, va, p->pid);
+      setkilled(p);
+    }
   } else {
     printf("usertrap: unexpected scause %x pid=%d\n", scause, p->pid);
     printf("sepc=%x stval=%x\n", r_sepc(), r_stval());
@@ -536,7 +553,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // 切换到用户页表
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvm_satp(p);
   // printf("satp=%x\n", satp);
   // printf("[RET] satp=%x\n", satp);
   // 跳转到trampoline.S中的userret
@@ -556,10 +573,22 @@ clockintr()
   //   release(&tickslock);
   // }
 
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+
+  // 调用到期的内核定时器（例如唤醒 sleep_ticks() 的进程）
+  timer_expire();
+
+  // 为定时器提前到来的中断不算时间片用完，不让出CPU
+  if(now >= c->slice_end){
+    c->slice_end = now + TIMESLICE;
+    c->resched = 1;
+  }
+
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // the interrupt request. an earlier kernel timer brings
+  // it forward.
+  w_stimecmp(timer_next(c->slice_end));
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -582,6 +611,8 @@ devintr()
       // uartintr();
     } else if(irq == VIRTIO0_IRQ){
       virtio_disk_intr();
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_swap_intr();
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -1,7 +1,16 @@
 #include "../include/def.h"
+#include "spinlock.h"
 #include <stdarg.h>
 volatile int panicking = 0; // printing a panic message
 volatile int panicked = 0;  // spinning forever at end of a panic
+
+// 一次 printf 的输出不和其他CPU的交错。panic 时不加锁，持有锁的
+// CPU 可能正是出错的那个。
+static struct spinlock pr_lock;
+
+void printfinit(void) {
+  initlock(&pr_lock, "pr");
+}
 static char digits[] = "0123456789abcdef";
 
 // 简单的整数转字符串函数
@@ -115,6 +124,9 @@ static void vprintf_internal(const char *fmt, va_list ap) {
 void printf(const char *fmt, ...) {
   va_list ap; // 声明va_list变量
 
+  if(!panicking)
+    acquire(&pr_lock);
+
   // 初始化可变参数列表，fmt是最后一个固定参数
   va_start(ap, fmt);
 
@@ -123,6 +135,9 @@ void printf(const char *fmt, ...) {
 
   // 清理可变参数列表
   va_end(ap);
+
+  if(!panicking)
+    release(&pr_lock);
 }
 void panic(char *s) {
   panicking = 1;
@@ -1,13 +1,46 @@
 #include "../include/def.h"
 
+// memset/memmove/memcpy/memcmp 以 64 位字为单位工作：先按字节处理到
+// 目的地址对齐，中间每次循环处理 8 个字（64 字节），最后处理剩余的
+// 字和字节。RISC-V 上非对齐的字访问会陷入 M 模式模拟，代价很高，
+// 因此只有源和目的相对于字长的偏移相同时才按字复制，否则逐字节。
+
+// 不小于 VEC_MINBYTES 的块在有 V 扩展时交给 vec.c。
+
+#define WSIZE   sizeof(uint64)
+#define WMASK   (WSIZE - 1)
+#define UNROLL  8
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = (uchar *) dst;
+  uint64 *w, pat;
+
+  if(n >= VEC_MINBYTES && vec_enabled){
+    vec_memset(dst, c, n);
+    return dst;
+  }
+  while(n > 0 && ((uint64)d & WMASK)){
+    *d++ = c;
+    n--;
   }
+
+  pat = (uchar)c;
+  pat |= pat << 8;
+  pat |= pat << 16;
+  pat |= pat << 32;
+  w = (uint64 *) d;
+  for(; n >= UNROLL*WSIZE; n -= UNROLL*WSIZE, w += UNROLL){
+    w[0] = pat; w[1] = pat; w[2] = pat; w[3] = pat;
+    w[4] = pat; w[5] = pat; w[6] = pat; w[7] = pat;
+  }
+  for(; n >= WSIZE; n -= WSIZE)
+    *w++ = pat;
+
+  d = (uchar *) w;
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -52,29 +85,151 @@ safestrcpy(char *s, const char *t, int n)
   return os;
 }
 
+// 从低地址向高地址复制
+static void
+copy_fwd(uchar *d, const uchar *s, uint n)
+{
+  uint64 *wd;
+  const uint64 *ws;
+
+  if((((uint64)d ^ (uint64)s) & WMASK) == 0){
+    while(n > 0 && ((uint64)d & WMASK)){
+      *d++ = *s++;
+      n--;
+    }
+    wd = (uint64 *) d;
+    ws = (const uint64 *) s;
+    for(; n >= UNROLL*WSIZE; n -= UNROLL*WSIZE, wd += UNROLL, ws += UNROLL){
+      uint64 t0 = ws[0], t1 = ws[1], t2 = ws[2], t3 = ws[3];
+      uint64 t4 = ws[4], t5 = ws[5], t6 = ws[6], t7 = ws[7];
+      wd[0] = t0; wd[1] = t1; wd[2] = t2; wd[3] = t3;
+      wd[4] = t4; wd[5] = t5; wd[6] = t6; wd[7] = t7;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = *ws++;
+    d = (uchar *) wd;
+    s = (const uchar *) ws;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+// 从高地址向低地址复制，d 和 s 指向区域末尾
+static void
+copy_bwd(uchar *d, const uchar *s, uint n)
+{
+  uint64 *wd;
+  const uint64 *ws;
+
+  if((((uint64)d ^ (uint64)s) & WMASK) == 0){
+    while(n > 0 && ((uint64)d & WMASK)){
+      *--d = *--s;
+      n--;
+    }
+    wd = (uint64 *) d;
+    ws = (const uint64 *) s;
+    for(; n >= UNROLL*WSIZE; n -= UNROLL*WSIZE){
+      wd -= UNROLL;
+      ws -= UNROLL;
+      uint64 t0 = ws[0], t1 = ws[1], t2 = ws[2], t3 = ws[3];
+      uint64 t4 = ws[4], t5 = ws[5], t6 = ws[6], t7 = ws[7];
+      wd[0] = t0; wd[1] = t1; wd[2] = t2; wd[3] = t3;
+      wd[4] = t4; wd[5] = t5; wd[6] = t6; wd[7] = t7;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *--wd = *--ws;
+    d = (uchar *) wd;
+    s = (const uchar *) ws;
+  }
+  while(n-- > 0)
+    *--d = *--s;
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
-  const char *s;
-  char *d;
+  const uchar *s = src;
+  uchar *d = dst;
 
-  if(n == 0)
+  if(n == 0 || d == s)
     return dst;
-  
-  s = src;
-  d = dst;
-  if(s < d && s + n > d){
-    s += n;
-    d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
+  // 向量复制逐段从低地址往高地址进行，d < s 时重叠也没有问题
+  if(n >= VEC_MINBYTES && vec_enabled && (d < s || s + n <= d)){
+    vec_memcpy(d, s, n);
+    return dst;
+  }
+  if(s < d && s + n > d)
+    copy_bwd(d + n, s + n, n);
+  else
+    copy_fwd(d, s, n);
+  return dst;
+}
 
+// 区域不能重叠
+void*
+memcpy(void *dst, const void *src, uint n)
+{
+  if(n >= VEC_MINBYTES && vec_enabled)
+    vec_memcpy(dst, src, n);
+  else
+    copy_fwd(dst, src, n);
   return dst;
 }
 
+// 以 32 位字为单位求和，作为页内容等的快速校验和。
+// p 按 4 字节对齐，不足一个字的尾部按字节累加。
+uint64
+memsum(const void *p, uint n)
+{
+  const uint32 *w = p;
+  const uchar *b;
+  uint64 sum = 0;
+  uint i, nw = n / 4;
+
+  if(n >= VEC_MINBYTES && vec_enabled)
+    sum = vec_memsum(w, nw);
+  else
+    for(i = 0; i < nw; i++)
+      sum += w[i];
+  b = (const uchar *)(w + nw);
+  for(i = nw * 4; i < n; i++)
+    sum += *b++;
+  return sum;
+}
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1 = v1, *s2 = v2;
+  const uint64 *w1, *w2;
+
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while(n > 0 && ((uint64)s1 & WMASK)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // 按字比较到第一个不同的字，再在字内逐字节找出差异
+    w1 = (const uint64 *) s1;
+    w2 = (const uint64 *) s2;
+    for(; n >= UNROLL*WSIZE; n -= UNROLL*WSIZE, w1 += UNROLL, w2 += UNROLL){
+      if(((w1[0] ^ w2[0]) | (w1[1] ^ w2[1]) | (w1[2] ^ w2[2]) | (w1[3] ^ w2[3]) |
+          (w1[4] ^ w2[4]) | (w1[5] ^ w2[5]) | (w1[6] ^ w2[6]) | (w1[7] ^ w2[7])) != 0)
+        break;
+    }
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    s1 = (const uchar *) w1;
+    s2 = (const uchar *) w2;
+  }
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
 int
 strncmp(const char *p, const char *q, uint n)
 {
@@ -0,0 +1,87 @@
+// RISC-V Vector (RVV) 加速的内存操作。
+//
+// start() 在 M 模式下从 misa 读出是否实现了 V 扩展，vecinit() 据此
+// 打开 vec_enabled。string.c 中的 memset/memmove/memcpy/memsum 对不
+// 小于 VEC_MINBYTES 的块调用这里的函数（页清零、页复制、缓冲区块
+// 复制都落在这里），其余情况以及没有 V 扩展时使用标量代码。
+//
+// 内核不保存向量寄存器。用户态的 sstatus.VS 始终为 Off，用户程序
+// 没有向量状态；内核每次使用前关中断并把 VS 置为 Initial，用完
+// 立即置回 Off，因此向量寄存器不会被其他代码看到或破坏。
+
+#include "../include/def.h"
+
+int vec_present;     // start() 根据 misa 设置
+int vec_enabled;     // vecinit() 之后才使用向量代码
+
+// rvv.S
+void vec_set(void *dst, int c, uint64 n);
+void vec_copy(void *dst, const void *src, uint64 n);
+uint64 vec_sum32(const uint32 *p, uint64 nwords);
+
+static inline void
+vec_begin(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+static inline void
+vec_end(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+
+// vlenb：向量寄存器的字节数，只有 VS 不为 Off 时才能读
+static inline uint64
+r_vlenb(void)
+{
+  uint64 x;
+  asm volatile("csrr %0, 0xc22" : "=r" (x) );
+  return x;
+}
+
+void
+vecinit(void)
+{
+  uint64 vlenb;
+
+  if(!vec_present){
+    printf("[VEC] no vector extension, using scalar string ops\n");
+    return;
+  }
+  vec_begin();
+  vlenb = r_vlenb();
+  vec_end();
+  vec_enabled = 1;
+  printf("[VEC] vector extension enabled, VLEN=%d bits\n", (int)(vlenb * 8));
+}
+
+void
+vec_memset(void *dst, int c, uint n)
+{
+  vec_begin();
+  vec_set(dst, c, n);
+  vec_end();
+}
+
+// 区域不重叠，或者 dst <= src
+void
+vec_memcpy(void *dst, const void *src, uint n)
+{
+  vec_begin();
+  vec_copy(dst, src, n);
+  vec_end();
+}
+
+uint64
+vec_memsum(const uint32 *p, uint nwords)
+{
+  uint64 sum;
+
+  vec_begin();
+  sum = vec_sum32(p, nwords);
+  vec_end();
+  return sum;
+}
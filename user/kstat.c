@@ -0,0 +1,60 @@
+// kstat - 打印内核统计计数器
+// 用法: kstat [n]   先执行 n 次 getpid 再打印，用于观察系统调用密集时的 TLB 刷新
+#include "./utils/syscall.h"
+#include "./utils/printf.h"
+
+static const char *names[KSTAT_NR] = {
+    [KSTAT_SYSCALL]       = "syscalls",
+    [KSTAT_TLB_FLUSH]     = "tlb full flushes",
+    [KSTAT_ASID_FLUSH]    = "asid flushes",
+    [KSTAT_ASID_ROLLOVER] = "asid rollovers",
+    [KSTAT_PCACHE_HIT]    = "page cache hits",
+    [KSTAT_PCACHE_MISS]   = "page cache misses",
+    [KSTAT_SWAP_OUT]      = "pages swapped out",
+    [KSTAT_SWAP_IN]       = "pages swapped in",
+    [KSTAT_ZRAM_STORE]    = "zram stores",
+    [KSTAT_ZRAM_HIT]      = "zram hits",
+    [KSTAT_ZRAM_MISS]     = "zram misses",
+    [KSTAT_ZRAM_ORIG]     = "zram original bytes",
+    [KSTAT_ZRAM_COMPR]    = "zram compressed bytes",
+    [KSTAT_KSM_SCANNED]   = "ksm pages scanned",
+    [KSTAT_KSM_PASSES]    = "ksm full scans",
+    [KSTAT_KSM_SHARED]    = "ksm merged pages",
+    [KSTAT_KSM_SAVED]     = "ksm pages saved",
+    [KSTAT_SCHED_STEAL]   = "sched steals",
+    [KSTAT_SCHED_MIGRATE] = "sched migrations",
+};
+
+static int atoi(const char *s) {
+    int n = 0;
+    while (*s >= '0' && *s <= '9')
+        n = n * 10 + (*s++ - '0');
+    return n;
+}
+
+void main(int argc, char *argv[]) {
+    long before[KSTAT_NR];
+    int n = 0;
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+
+    for (int i = 0; i < KSTAT_NR; i++)
+        before[i] = sys_kstat(i);
+    for (int i = 0; i < n; i++)
+        sys_getpid();
+
+    for (int i = 0; i < KSTAT_NR; i++) {
+        long v = sys_kstat(i);
+        if (n > 0)
+            printf("%s: %d (+%d)\n", names[i], (int)v, (int)(v - before[i]));
+        else
+            printf("%s: %d\n", names[i], (int)v);
+    }
+
+    long orig = sys_kstat(KSTAT_ZRAM_ORIG), compr = sys_kstat(KSTAT_ZRAM_COMPR);
+    if (compr > 0)
+        printf("zram compression ratio: %d.%d\n",
+               (int)(orig / compr), (int)(orig * 10 / compr % 10));
+    sys_exit(0);
+}
@@ -0,0 +1,31 @@
+// memstat - 打印进程的内存统计
+// 用法: memstat [pid...]   不带参数时打印自己的
+#include "./utils/syscall.h"
+#include "./utils/printf.h"
+
+static int atoi(const char *s) {
+    int n = 0;
+    while (*s >= '0' && *s <= '9')
+        n = n * 10 + (*s++ - '0');
+    return n;
+}
+
+static void show(int pid) {
+    struct memstat st;
+
+    if (sys_memstat(pid, &st) < 0) {
+        printf("memstat: no process %d\n", pid);
+        return;
+    }
+    printf("pid %d: rss %d wss %d dirty %d swapped %d minflt %d majflt %d\n",
+           pid ? pid : sys_getpid(), (int)st.rss, (int)st.wss, (int)st.dirty,
+           (int)st.swapped, (int)st.minflt, (int)st.majflt);
+}
+
+void main(int argc, char *argv[]) {
+    if (argc < 2)
+        show(0);
+    for (int i = 1; i < argc; i++)
+        show(atoi(argv[i]));
+    sys_exit(0);
+}
@@ -0,0 +1,72 @@
+// mmaptest - 检查 mmap/munmap
+// 用法: mmaptest [file]   file 默认为 mmaptest.tmp，会被创建并改写
+#include "./utils/syscall.h"
+#include "./utils/printf.h"
+
+#define PGSIZE 4096
+
+static int fail(const char *what) {
+    printf("mmaptest: %s failed\n", what);
+    sys_exit(1);
+    return -1;
+}
+
+void main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "mmaptest.tmp";
+    char buf[64];
+    char *p, *q;
+    int fd, i;
+
+    // 准备两页内容已知的文件
+    if ((fd = sys_open(path, O_CREATE | O_RDWR | O_TRUNC)) < 0)
+        fail("open");
+    for (i = 0; i < 2 * PGSIZE / (int)sizeof(buf); i++) {
+        for (int j = 0; j < (int)sizeof(buf); j++)
+            buf[j] = 'a' + (i * sizeof(buf) + j) / PGSIZE;
+        if (sys_write(fd, buf, sizeof(buf)) != sizeof(buf))
+            fail("write");
+    }
+
+    // 私有映射：能读到文件内容，写入不影响文件
+    p = sys_mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        fail("mmap private");
+    if (p[0] != 'a' || p[PGSIZE] != 'b')
+        fail("private read");
+    p[0] = 'x';
+    if (sys_munmap(p, 2 * PGSIZE) < 0)
+        fail("munmap private");
+
+    // 共享映射：写入在 munmap 时写回文件
+    q = sys_mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (q == MAP_FAILED || q[0] != 'a')
+        fail("mmap shared");
+    q[PGSIZE + 1] = 'Z';
+    if (sys_munmap(q, 2 * PGSIZE) < 0)
+        fail("munmap shared");
+    sys_close(fd);
+
+    if ((fd = sys_open(path, O_RDONLY)) < 0)
+        fail("reopen");
+    for (i = 0; i <= PGSIZE / (int)sizeof(buf); i++)
+        sys_read(fd, buf, sizeof(buf));
+    if (buf[0] != 'b' || buf[1] != 'Z')
+        fail("shared write-back");
+    sys_close(fd);
+
+    // 共享匿名映射：fork 之后父子进程看到同一页
+    p = sys_mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED || p[0] != 0)
+        fail("mmap anonymous");
+    if (sys_fork() == 0) {
+        p[0] = 42;
+        sys_exit(0);
+    }
+    sys_wait();
+    if (p[0] != 42)
+        fail("shared anonymous");
+
+    sys_unlink(path);
+    printf("mmaptest: ok\n");
+    sys_exit(0);
+}
@@ -18,6 +18,32 @@
 #define SYS_FSTAT   12
 #define SYS_UNLINK  13
 #define SYS_MKDIR   14
+#define SYS_KSTAT   15
+#define SYS_MMAP    16
+#define SYS_MUNMAP  17
+#define SYS_MEMSTAT 18
+
+// 内核统计计数器编号（需与内核 def.h 保持一致）
+#define KSTAT_SYSCALL       0   // 系统调用次数
+#define KSTAT_TLB_FLUSH     1   // 整个 TLB 的刷新次数
+#define KSTAT_ASID_FLUSH    2   // 按 ASID 作废某个地址空间的次数
+#define KSTAT_ASID_ROLLOVER 3   // ASID 代数回绕次数
+#define KSTAT_PCACHE_HIT    4   // 只读文件页在页缓存中命中
+#define KSTAT_PCACHE_MISS   5   // 只读文件页需要从文件读入
+#define KSTAT_SWAP_OUT      6   // 换出到交换盘的页数
+#define KSTAT_SWAP_IN       7   // 从交换盘换入的页数
+#define KSTAT_ZRAM_STORE    8   // 压缩存入内存的页数
+#define KSTAT_ZRAM_HIT      9   // 换入时在压缩内存中找到
+#define KSTAT_ZRAM_MISS     10  // 换入时要从交换盘读
+#define KSTAT_ZRAM_ORIG     11  // 压缩内存中页面的原始字节数（当前值）
+#define KSTAT_ZRAM_COMPR    12  // 压缩数据占用的字节数（当前值）
+#define KSTAT_KSM_SCANNED   13  // ksmd 扫描过的页数
+#define KSTAT_KSM_PASSES    14  // ksmd 扫完所有进程的圈数
+#define KSTAT_KSM_SHARED    15  // 合并页的个数（上一圈结束时）
+#define KSTAT_KSM_SAVED     16  // 合并省下的页数（上一圈结束时）
+#define KSTAT_SCHED_STEAL   17  // 空闲CPU从其他运行队列偷来的进程数
+#define KSTAT_SCHED_MIGRATE 18  // 进程换到另一个CPU上运行的次数
+#define KSTAT_NR            19
 
 static inline long do_syscall(long n, long a0, long a1, long a2) {
     register long x10 asm("a0") = a0;
@@ -28,6 +54,22 @@ static inline long do_syscall(long n, long a0, long a1, long a2) {
     return x10;
 }
 
+// 最多 6 个参数的系统调用（mmap）
+static inline long do_syscall6(long n, long a0, long a1, long a2,
+                               long a3, long a4, long a5) {
+    register long x10 asm("a0") = a0;
+    register long x11 asm("a1") = a1;
+    register long x12 asm("a2") = a2;
+    register long x13 asm("a3") = a3;
+    register long x14 asm("a4") = a4;
+    register long x15 asm("a5") = a5;
+    register long x17 asm("a7") = n;
+    asm volatile ("ecall" : "+r"(x10)
+                  : "r"(x11), "r"(x12), "r"(x13), "r"(x14), "r"(x15), "r"(x17)
+                  : "memory");
+    return x10;
+}
+
 static inline int sys_getpid(void) {
     return (int)do_syscall(SYS_GETPID, 0, 0, 0);
 }
@@ -88,6 +130,44 @@ static inline int sys_fstat(int fd, void *stat) {
     return (int)do_syscall(SYS_FSTAT, fd, (long)stat, 0);
 }
 
+static inline long sys_kstat(int id) {
+    return do_syscall(SYS_KSTAT, id, 0, 0);
+}
+
+// mmap 的 prot 与 flags（需与内核 def.h 保持一致）
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED    ((void *)-1)
+
+static inline void *sys_mmap(void *addr, unsigned long len, int prot,
+                             int flags, int fd, unsigned long off) {
+    return (void *)do_syscall6(SYS_MMAP, (long)addr, (long)len, prot,
+                               flags, fd, (long)off);
+}
+
+static inline int sys_munmap(void *addr, unsigned long len) {
+    return (int)do_syscall(SYS_MUNMAP, (long)addr, (long)len, 0);
+}
+
+// 进程的内存统计，单位是页（需与内核 def.h 保持一致）
+struct memstat {
+    uint64_t rss;       // 驻留的用户页
+    uint64_t wss;       // 上一个采样周期内访问过的页（工作集）
+    uint64_t dirty;     // 上一个采样周期内写过的页
+    uint64_t swapped;   // 换出的页
+    uint64_t minflt;    // 不需要换入的缺页
+    uint64_t majflt;    // 需要换入的缺页
+};
+
+// pid 为 0 表示当前进程
+static inline int sys_memstat(int pid, struct memstat *st) {
+    return (int)do_syscall(SYS_MEMSTAT, pid, (long)st, 0);
+}
+
 #endif
 
 